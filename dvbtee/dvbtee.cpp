@@ -27,6 +27,7 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "batch.h"
 #include "feed.h"
 #include "hlsfeed.h"
 
@@ -286,10 +287,15 @@ void usage(bool help, char *myname)
 		"-a\tadapter id\n  "
 		"-A\t(1 for ATSC, 2 for ClearQAM)\n  "
 		"-b\tdisplay bitrates & statistics\n  "
+		"-B\tparse on a separate thread from input, optional arg is the buffer size in bytes\n  "
 		"-c\tchannel to tune /\n\tcomma (,) separated list of channels to scan /\n\tscan minimum channel\n  "
 		"-C\tchannel to tune /\n\tcomma (,) separated list of channels to scan /\n\tscan maximum channel\n  "
 		"-f\tfrontend id\n  "
 		"-F\tfilename to use as input\n  "
+		"-G\tfile name or quoted glob of files to parse side by side and report on as one,\n\tmay be given more than once\n  "
+		"-W\tnumber of files to parse at once with -G, 0 (the default) for one per cpu\n  "
+		"-r\tplay the input file back in real time, optional arg is the speed, ie 2 for twice as fast\n  "
+		"-l\tloop the input file\n  "
 		"-t\ttimeout\n  "
 		"-T\tnumber of tuners (dvb adapters) allowed to use, 0 for all\n  "
 		"-s\tscan, optional arg when using multiple tuners: \n\t1 for speed, 2 for redundancy, \n\t3 for speed AND redundancy, \n\t4 for optimized speed / partial redundancy\n  "
@@ -312,8 +318,14 @@ void usage(bool help, char *myname)
 		"%s -itcp://5555 -oudp://192.168.1.100:1234\n\n"
 		"To parse a captured file and filter out the PSIP data, saving the PAT/PMT and PES streams to a file:\n  "
 		"%s -Finput.ts -O3 -ofile://output.ts\n\n"
+		"To list the channels and EPG found in a directory of captured files, four at a time:\n  "
+		"%s -G'captures/*.ts' -W4 -E\n\n"
+		"To replay a captured file at its own pace to a UDP port, over and over:\n  "
+		"%s -Finput.ts -r -l -oudp://192.168.1.100:1234\n\n"
 		"To parse a UDP stream for ten seconds:\n  "
 		"%s -iudp://127.0.0.1:1234 -t10\n\n"
+		"To parse a source specific multicast stream received on eth1:\n  "
+		"%s -iudp://10.0.0.1@232.1.1.1:1234?iface=eth1\n\n"
 		"To scan for ClearQAM services using 5 tuners optimized for speed and partial redundancy:\n  "
 		"%s -A2 -T5 -s4\n\n"
 		"To scan for ATSC services using 2 HdHomeRun tuners optimized for speed and redundancy:\n  "
@@ -322,7 +334,7 @@ void usage(bool help, char *myname)
 		"%s -a0 -S\n\n"
 		"To start a server using tuner1 of a specific HdHomeRun device (ex: ABCDABCD):\n  "
 		"%s -H ABCDABCD-1 -S\n\n"
-		, myname, myname, myname, myname, myname, myname, myname, myname, myname
+		, myname, myname, myname, myname, myname, myname, myname, myname, myname, myname, myname, myname
 	);
 }
 
@@ -362,6 +374,12 @@ int main(int argc, char **argv)
 
 	unsigned int wait_event  = 0;
 	int eit_limit            = -1;
+	int feed_buffer          = 0;
+	double pace_speed        = 0;
+	bool b_loop              = false;
+	unsigned int batch_workers = 0;
+
+	batch analyzer;
 
 	tune *tuner = NULL;
 
@@ -385,7 +403,7 @@ int main(int argc, char **argv)
 	char hdhrname[256];
 	memset(&hdhrname, 0, sizeof(hdhrname));
 
-	while ((opt = getopt(argc, argv, "a:A:bc:C:f:F:t:T:i:I:s::S::E::o::O:d::H::h?")) != -1) {
+	while ((opt = getopt(argc, argv, "a:A:bB::c:C:f:F:G:W:lr::t:T:i:I:s::S::E::o::O:d::H::h?")) != -1) {
 		switch (opt) {
 		case 'a': /* adapter */
 #ifdef USE_LINUXTV
@@ -400,6 +418,15 @@ int main(int argc, char **argv)
 		case 'b': /* bitrates & statistics */
 			b_bitrate_stats = true;
 			break;
+		case 'B': /* decoupled parser thread, optional arg is the buffer size */
+			feed_buffer = (optarg) ? strtoul(optarg, NULL, 0) : FEED_BUFFER_SIZE;
+			break;
+		case 'l': /* loop the input file */
+			b_loop = true;
+			break;
+		case 'r': /* real time file playback, optional arg is the speed */
+			pace_speed = (optarg) ? strtod(optarg, NULL) : 1;
+			break;
 		case 'c': /* channel list | channel / scan min */
 			if (strstr(optarg, ","))
 				strncpy(channel_list, optarg, sizeof(channel_list)-1);
@@ -428,6 +455,12 @@ int main(int argc, char **argv)
 		case 'F': /* Filename */
 			strncpy(filename, optarg, sizeof(filename));
 			break;
+		case 'G': /* file name or glob, parsed side by side with the others */
+			analyzer.add(optarg);
+			break;
+		case 'W': /* number of files to parse at once */
+			batch_workers = strtoul(optarg, NULL, 0);
+			break;
 		case 't': /* timeout */
 			timeout = strtoul(optarg, NULL, 0);
 			break;
@@ -561,6 +594,11 @@ int main(int argc, char **argv)
 		}
 	}
 #endif
+	if (feed_buffer > 0) {
+		context._file_feeder.set_buffer_size(feed_buffer);
+		for (map_tuners::const_iterator iter = context.tuners.begin(); iter != context.tuners.end(); ++iter)
+			iter->second->feeder.set_buffer_size(feed_buffer);
+	}
 	if (out_opt > 0) {
 		if ((strlen(tcpipfeedurl)) || (strlen(filename)))
 			context._file_feeder.parser.out.set_options(out_opt);
@@ -610,7 +648,31 @@ int main(int argc, char **argv)
 		goto exit;
 	}
 
+	if (analyzer.get_file_count()) {
+		analyzer.set_epg(scan_epg);
+		analyzer.limit_eit(eit_limit);
+		analyzer.run(batch_workers);
+
+		const batch_results &results = analyzer.get_results();
+		unsigned int failed = 0;
+		for (batch_results::const_iterator iter = results.begin(); iter != results.end(); ++iter)
+			if ((!iter->opened) || (!iter->psip_ready)) {
+				fprintf(stderr, "%s: %s\n", iter->filename.c_str(),
+					(iter->opened) ? "incomplete PSIP" : "failed to open");
+				failed++;
+			}
+		fprintf(stderr, "%zu files parsed, %u failed\n", results.size(), failed);
+
+		fprintf(stdout, "\n# %zu files\n", results.size());
+		analyzer.xine_dump();
+		if (scan_epg)
+			analyzer.epg_dump();
+		goto exit;
+	}
+
 	if (strlen(filename)) {
+		context._file_feeder.set_pacing(pace_speed);
+		context._file_feeder.set_loop(b_loop);
 		if (0 <= context._file_feeder.open_file(filename)) {
 			int ret = context._file_feeder.start();
 			if (b_serve) goto exit;
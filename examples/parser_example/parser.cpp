@@ -199,41 +199,12 @@ int main(int argc, char **argv)
 	}
 
 	/* if we're not feeding a file or url then read from stdin */
-	if (NULL == freopen(NULL, "rb", stdin)) {
-		fprintf(stderr, "failed to open stdin!\n");
-		goto exit;
-	}
-
-#define BUFSIZE ((4096/188)*188)
 	if (context.server) {
-		/* 100 is the magic number to signify:
-		   "do not call setpriority on feed thread"
-		   otherwise, set a value between -20 and 19
-		   **prio only works if the feed class is
-		   built with double-buffer support.
-		 */
-		context.feeder.setup_feed(100);
-		while (context.server->is_running()) {
-			ssize_t r;
-			unsigned char q[BUFSIZE];
-			int available;
-
-			available = sizeof(q);
-
-			available = (available < BUFSIZE) ? available : BUFSIZE;
-			if ((r = fread(q, 188, available / 188, stdin)) < (available / 188)) {
-				if (ferror(stdin)) {
-					fprintf(stderr, "%s: error reading stdin!\n", __func__);
-					usleep(50*1000);
-					clearerr(stdin);
-				}
-				if (feof(stdin)) {
-					fprintf(stderr, "%s: EOF\n", __func__);
-					stop_server(&context);
-				}
-			}
-			/* push data into the library */
-			context.feeder.push(r * 188, q);
+		if (0 == context.feeder.start_stdin()) {
+			while ((context.server->is_running()) &&
+			       (!context.feeder.wait_for_streaming_or_timeout(1)))
+				;
+			context.feeder.stop();
 		}
 	}
 exit:
@@ -0,0 +1,321 @@
+/*****************************************************************************
+ * Copyright (C) 2011-2015 Michael Ira Krufky
+ *
+ * Author: Michael Ira Krufky <mkrufky@linuxtv.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+#include <fcntl.h>
+#include <glob.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "log.h"
+#define CLASS_MODULE "batch"
+
+#define dprintf(fmt, arg...) __dprintf(DBG_FEED, fmt, ##arg)
+
+/* what the parser of a worker found in one file, merged once it is done */
+class batch_collector : public parse_iface, public decode_report
+{
+public:
+	std::vector<batch_channel_t> channels;
+	std::vector<decoded_event_t> events;
+
+	void chandump(parsed_channel_info_t *c)
+	{
+		batch_channel_t chan;
+
+		chan.info = *c;
+		chan.info.modulation = NULL;
+		if (c->modulation)
+			chan.modulation.assign(c->modulation);
+		chan.files = 1;
+		channels.push_back(chan);
+	}
+	void epg_header_footer(bool, bool) {}
+	void epg_event(decoded_event_t &e) { events.push_back(e); }
+	void print(const char *, ...) {}
+};
+
+batch::batch()
+  : f_epg(false)
+  , eit_limit(-1)
+  , next_file(0)
+  , f_kill_thread(false)
+  , workers(NULL)
+  , num_workers(0)
+{
+	dprintf("()");
+
+	pthread_mutex_init(&mutex, 0);
+}
+
+batch::~batch()
+{
+	dprintf("()");
+
+	pthread_mutex_destroy(&mutex);
+}
+
+int batch::add(const char *pattern)
+{
+	glob_t g;
+	int count = 0;
+
+	dprintf("(%s)", pattern);
+
+	/* no match leaves the pattern itself, reported as a file not opened */
+	if (0 != glob(pattern, GLOB_NOCHECK, NULL, &g)) {
+		fprintf(stderr, "%s: failed to expand %s\n", __func__, pattern);
+		return -1;
+	}
+	for (size_t i = 0; i < g.gl_pathc; i++, count++)
+		files.push_back(g.gl_pathv[i]);
+
+	globfree(&g);
+
+	return count;
+}
+
+int batch::run(unsigned int n)
+{
+	unsigned int i;
+
+	if (!n) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		n = (cpus > 0) ? cpus : 1;
+	}
+	if (n > BATCH_MAX_WORKERS)
+		n = BATCH_MAX_WORKERS;
+	if (n > files.size())
+		n = files.size();
+	if (!n)
+		return 0;
+
+	dprintf("(%zu files, %d workers)", files.size(), n);
+
+	results.clear();
+	results.resize(files.size());
+	for (i = 0; i < files.size(); i++) {
+		results[i].filename = files[i];
+		results[i].opened = false;
+		results[i].psip_ready = false;
+		results[i].packets = 0;
+		results[i].channels = 0;
+		results[i].events = 0;
+	}
+	channels.clear();
+	epg.clear();
+
+	next_file = 0;
+	f_kill_thread = false;
+
+	pthread_mutex_lock(&mutex);
+	workers = new batch_worker[n];
+	for (i = 0; i < n; i++) {
+		workers[i].owner = this;
+		workers[i].feeder.parser.limit_eit(eit_limit);
+	}
+	num_workers = n;
+	pthread_mutex_unlock(&mutex);
+
+	/* this thread is the first worker */
+	for (i = 1; i < n; i++) {
+		int ret = pthread_create(&workers[i].h_thread, NULL, worker_thread, &workers[i]);
+		if (0 != ret) {
+			perror("pthread_create() failed");
+			break;
+		}
+	}
+	work(&workers[0].feeder);
+
+	while (--i > 0)
+		pthread_join(workers[i].h_thread, NULL);
+
+	pthread_mutex_lock(&mutex);
+	num_workers = 0;
+	delete[] workers;
+	workers = NULL;
+	pthread_mutex_unlock(&mutex);
+
+	return 0;
+}
+
+void batch::stop()
+{
+	dprintf("()");
+
+	__atomic_store_n(&f_kill_thread, true, __ATOMIC_RELEASE);
+
+	pthread_mutex_lock(&mutex);
+	for (unsigned int i = 0; i < num_workers; i++)
+		workers[i].feeder.stop_without_wait();
+	pthread_mutex_unlock(&mutex);
+}
+
+//static
+void *batch::worker_thread(void *p_worker)
+{
+	struct batch_worker *worker = (struct batch_worker*)p_worker;
+
+	worker->owner->work(&worker->feeder);
+	pthread_exit(NULL);
+}
+
+void batch::work(feed *feeder)
+{
+	unsigned int idx;
+
+	while ((!__atomic_load_n(&f_kill_thread, __ATOMIC_ACQUIRE)) &&
+	       ((idx = __atomic_fetch_add(&next_file, 1, __ATOMIC_RELAXED)) < files.size()))
+		parse_file(feeder, idx);
+}
+
+void batch::parse_file(feed *feeder, unsigned int idx)
+{
+	batch_file_result_t *result = &results[idx];
+	batch_collector collector;
+
+	dprintf("(%s)", files[idx].c_str());
+
+	/* as the tuners do from one channel to the next */
+	feeder->parser.cleanup();
+	feeder->parser.reset();
+	feeder->set_packet_size(0);
+
+	/* open_file() would cut long paths short */
+	int fd = open(files[idx].c_str(), O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "%s: failed to open %s\n", __func__, files[idx].c_str());
+		return;
+	}
+	unsigned int fed = feeder->parser.get_fed_pkt_count();
+
+	feeder->open_file(fd);
+	feeder->parse_file();
+
+	result->opened = true;
+	result->psip_ready = feeder->parser.is_psip_ready();
+	result->packets = feeder->parser.get_fed_pkt_count() - fed;
+	result->channels = feeder->parser.xine_dump(&collector);
+	if (f_epg)
+		feeder->parser.epg_dump(&collector);
+	result->events = collector.events.size();
+
+	merge(collector);
+}
+
+void batch::merge(batch_collector &collector)
+{
+	char key[64];
+
+	pthread_mutex_lock(&mutex);
+
+	for (std::vector<batch_channel_t>::const_iterator iter = collector.channels.begin(); iter != collector.channels.end(); ++iter) {
+		const parsed_channel_info_t *c = &iter->info;
+
+		snprintf(key, sizeof(key), "%05d %010u %05d %05d %05d %05d %05d %05d ",
+			 c->physical_channel, c->freq, c->major, c->minor, c->lcn,
+			 c->program_number, c->vpid, c->apid);
+
+		std::string k = std::string(key) + (const char *)c->service_name + " " + iter->modulation;
+
+		map_batch_channels::iterator found = channels.find(k);
+		if (found != channels.end())
+			found->second.files++;
+		else
+			channels[k] = *iter;
+	}
+
+	for (std::vector<decoded_event_t>::const_iterator iter = collector.events.begin(); iter != collector.events.end(); ++iter) {
+		snprintf(key, sizeof(key), "%05d %05d %05d %05d ",
+			 iter->chan_physical, iter->chan_major, iter->chan_minor, iter->chan_svc_id);
+
+		map_batch_events &events = epg[std::string(key) + iter->channel_name];
+
+		snprintf(key, sizeof(key), "%020lld %05d", (long long)iter->start_time, iter->event_id);
+
+		map_batch_events::iterator found = events.find(key);
+		if (found != events.end())
+			found->second.files++;
+		else {
+			batch_event_t &e = events[key];
+			e.event = *iter;
+			e.files = 1;
+		}
+	}
+
+	pthread_mutex_unlock(&mutex);
+}
+
+unsigned int batch::xine_dump(parse_iface *iface)
+{
+	unsigned int count = 0;
+
+	for (map_batch_channels::const_iterator iter = channels.begin(); iter != channels.end(); ++iter) {
+		parsed_channel_info_t c = iter->second.info;
+
+		c.modulation = (iter->second.modulation.size()) ? iter->second.modulation.c_str() : NULL;
+
+		if (iface)
+			iface->chandump(&c);
+		else
+			xine_chandump(&c);
+		count++;
+	}
+	return count;
+}
+
+void batch::epg_dump(decode_report *reporter)
+{
+	if (reporter) reporter->epg_header_footer(true, false);
+
+	for (map_batch_epg::const_iterator iter = epg.begin(); iter != epg.end(); ++iter) {
+		const decoded_event_t &first = iter->second.begin()->second.event;
+
+		if (reporter)
+			reporter->epg_header_footer(true, true);
+		else
+			fprintf(stdout, "\n# epg %d, %d.%d: %s, service %d\n",
+				first.chan_physical, first.chan_major, first.chan_minor,
+				first.channel_name.c_str(), first.chan_svc_id);
+
+		for (map_batch_events::const_iterator iter_ev = iter->second.begin(); iter_ev != iter->second.end(); ++iter_ev) {
+			decoded_event_t e = iter_ev->second.event;
+
+			if (reporter) {
+				reporter->epg_event(e);
+				continue;
+			}
+			time_t end = e.start_time + e.length_sec;
+			struct tm tms, tme;
+			localtime_r(&e.start_time, &tms);
+			localtime_r(&end, &tme);
+
+			fprintf(stdout, "%04d-%02d-%02d %02d:%02d - %02d:%02d : %s\n",
+				tms.tm_year + 1900, tms.tm_mon + 1, tms.tm_mday,
+				tms.tm_hour, tms.tm_min, tme.tm_hour, tme.tm_min, e.name.c_str());
+		}
+		if (reporter) reporter->epg_header_footer(false, true);
+	}
+
+	if (reporter) reporter->epg_header_footer(false, false);
+}
@@ -0,0 +1,131 @@
+/*****************************************************************************
+ * Copyright (C) 2011-2015 Michael Ira Krufky
+ *
+ * Author: Michael Ira Krufky <mkrufky@linuxtv.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include <map>
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+#include "feed.h"
+
+/* the most worker threads run() will start */
+#define BATCH_MAX_WORKERS 64
+
+typedef struct {
+	std::string filename;
+	bool opened;
+	bool psip_ready;	/* PAT, PMTs and, where expected, the VCT */
+	unsigned int packets;
+	unsigned int channels;
+	unsigned int events;
+} batch_file_result_t;
+
+typedef std::vector<batch_file_result_t> batch_results;
+
+typedef struct {
+	parsed_channel_info_t info;
+	std::string modulation;	/* info.modulation goes with its parser */
+	unsigned int files;	/* that the channel was found in */
+} batch_channel_t;
+
+typedef struct {
+	decoded_event_t event;
+	unsigned int files;
+} batch_event_t;
+
+/* keyed so that channels sort by physical channel, then channel number,
+ * and the events of a channel by their start time */
+typedef std::map<std::string, batch_channel_t> map_batch_channels;
+typedef std::map<std::string, batch_event_t> map_batch_events;
+typedef std::map<std::string, map_batch_events> map_batch_epg;
+
+class batch_collector;
+
+/* parses many captured files at once on a fixed number of worker threads,
+ * each with a feed and parser of its own that is reset from one file to
+ * the next.  the channels and EPG events found in all of the files are
+ * merged, each listed once however many files it was found in */
+class batch
+{
+public:
+	batch();
+	~batch();
+
+	/* a file name or a glob(7) pattern.  returns the number of files added */
+	int add(const char *pattern);
+	unsigned int get_file_count() { return files.size(); }
+
+	/* collect EPG events as well as channels */
+	void set_epg(bool enable) { f_epg = enable; }
+	void limit_eit(int limit) { eit_limit = limit; }
+
+	/* parses every file added and returns once all are done.  0 workers
+	 * starts one per online cpu, never more than there are files */
+	int run(unsigned int workers = 0);
+	/* from another thread, the files in progress are cut short */
+	void stop();
+
+	/* the merged results, as parse::xine_dump() and parse::epg_dump() */
+	unsigned int xine_dump(parse_iface *iface = NULL);
+	void epg_dump(decode_report *reporter = NULL);
+
+	/* one per file, in the order they were added */
+	const batch_results &get_results() { return results; }
+private:
+	/* not copyable */
+	batch(const batch&);
+	batch& operator= (const batch&);
+
+	std::vector<std::string> files;
+	batch_results results;
+
+	bool f_epg;
+	int eit_limit;
+
+	/* the next file to be claimed by a worker */
+	unsigned int next_file;
+	bool f_kill_thread;
+
+	/* each with a parser of its own, for as long as run() takes */
+	struct batch_worker {
+		batch *owner;
+		feed feeder;
+		pthread_t h_thread;
+	} *workers;
+	unsigned int num_workers;
+
+	static void *worker_thread(void*);
+	void work(feed *);
+	void parse_file(feed *, unsigned int idx);
+
+	/* guards workers and the merged results, taken once per file */
+	pthread_mutex_t mutex;
+
+	map_batch_channels channels;
+	map_batch_epg epg;
+
+	void merge(batch_collector&);
+};
+
+#endif /* __BATCH_H__ */
@@ -61,13 +61,6 @@ decode_report::~decode_report()
 #endif
 }
 
-static map_network_decoder   networks;
-
-void clear_decoded_networks()
-{
-	networks.clear();
-}
-
 decode_network_service::decode_network_service()
   : services_w_eit_pf(0)
   , services_w_eit_sched(0)
@@ -219,6 +212,7 @@ decode_network& decode_network::operator= (const decode_network& cSource)
 decode::decode()
   : orig_network_id(0)
   , network_id(0)
+  , networks(&local_networks)
   , stream_time((time_t)0)
   , eit_x(0)
   , physical_channel(0)
@@ -321,6 +315,7 @@ decode::decode(const decode&)
 
 	orig_network_id = 0;
 	network_id = 0;
+	networks = &local_networks;
 	stream_time = (time_t)0;
 	eit_x = 0;
 	physical_channel = 0;
@@ -366,6 +361,7 @@ decode& decode::operator= (const decode& cSource)
 
 	orig_network_id = 0;
 	network_id = 0;
+	networks = &local_networks;
 	stream_time = (time_t)0;
 	eit_x = 0;
 	physical_channel = 0;
@@ -377,9 +373,11 @@ decode& decode::operator= (const decode& cSource)
 #if !USING_DVBPSI_VERSION_0
 bool decode::take_stt(const dvbpsi_atsc_stt_t * const p_stt)
 {
+	char time_str[26];
+
 	stream_time = atsc_datetime_utc(p_stt->i_system_time);
 
-	dbg_time("%s", ctime(&stream_time));
+	dbg_time("%s", ctime_r(&stream_time, time_str));
 
 	descriptors.decode(p_stt->p_first_descriptor);
 
@@ -389,9 +387,11 @@ bool decode::take_stt(const dvbpsi_atsc_stt_t * const p_stt)
 
 bool decode::take_tot(const dvbpsi_tot_t * const p_tot)
 {
+	char time_str[26];
+
 	stream_time = datetime_utc(p_tot->i_utc_time);
 
-	dbg_time("%s", ctime(&stream_time));
+	dbg_time("%s", ctime_r(&stream_time, time_str));
 
 	descriptors.decode(p_tot->p_first_descriptor);
 
@@ -702,16 +702,16 @@ bool decode::take_nit_actual(const dvbpsi_nit_t * const p_nit)
 {
 	network_id = p_nit->i_network_id;
 #if 0
-	return networks[network_id].take_nit(p_nit);
+	return (*networks)[network_id].take_nit(p_nit);
 #else
-	bool ret = networks[network_id].take_nit(p_nit);
+	bool ret = (*networks)[network_id].take_nit(p_nit);
 	const decoded_nit_t *decoded_nit = get_decoded_nit();
 	if ((decoded_nit) && (decoded_nit->ts_list.count(decoded_pat.ts_id))) {
 		orig_network_id = ((decoded_nit_t*)decoded_nit)->ts_list[decoded_pat.ts_id].orig_network_id;
 
-		networks[network_id].orig_network_id = orig_network_id;
+		(*networks)[network_id].orig_network_id = orig_network_id;
 #if 0
-		return networks[orig_network_id].take_nit(p_nit);
+		return (*networks)[orig_network_id].take_nit(p_nit);
 #endif
 	}
 	return ret;
@@ -721,16 +721,16 @@ bool decode::take_nit_actual(const dvbpsi_nit_t * const p_nit)
 bool decode::take_nit_other(const dvbpsi_nit_t * const p_nit)
 {
 #if 0
-	return networks[p_nit->i_network_id].take_nit(p_nit);
+	return (*networks)[p_nit->i_network_id].take_nit(p_nit);
 #else
-	bool ret = networks[p_nit->i_network_id].take_nit(p_nit);
+	bool ret = (*networks)[p_nit->i_network_id].take_nit(p_nit);
 	const decoded_nit_t *decoded_nit = get_decoded_nit();
 	if ((decoded_nit) && (decoded_nit->ts_list.count(decoded_pat.ts_id))) {
 		uint16_t other_orig_network_id = ((decoded_nit_t*)decoded_nit)->ts_list[decoded_pat.ts_id].orig_network_id;
 
-		networks[p_nit->i_network_id].orig_network_id = other_orig_network_id;
+		(*networks)[p_nit->i_network_id].orig_network_id = other_orig_network_id;
 #if 0
-		return networks[other_orig_network_id].take_nit(p_nit);
+		return (*networks)[other_orig_network_id].take_nit(p_nit);
 #endif
 	}
 	return ret;
@@ -819,7 +819,7 @@ bool decode::take_sdt_actual(const dvbpsi_sdt_t * const p_sdt)
 {
 	orig_network_id = p_sdt->i_network_id;
 
-	decode_network &nw = networks[orig_network_id];
+	decode_network &nw = (*networks)[orig_network_id];
 
 	nw.orig_network_id = orig_network_id;
 
@@ -828,7 +828,7 @@ bool decode::take_sdt_actual(const dvbpsi_sdt_t * const p_sdt)
 
 bool decode::take_sdt_other(const dvbpsi_sdt_t * const p_sdt)
 {
-	decode_network &nw = networks[p_sdt->i_network_id];
+	decode_network &nw = (*networks)[p_sdt->i_network_id];
 
 	nw.orig_network_id = p_sdt->i_network_id;
 
@@ -888,8 +888,9 @@ bool __take_eit(const dvbpsi_eit_t * const p_eit, map_decoded_eit *decoded_eit,
 		time_t start = datetime_utc(cur_event.start_time /*+ (60 * tz_offset)*/);
 		time_t end   = datetime_utc(cur_event.start_time + cur_event.length_sec /*+ (60 * tz_offset)*/);
 
-		struct tm tms = *localtime(&start);
-		struct tm tme = *localtime(&end);
+		struct tm tms, tme;
+		localtime_r(&start, &tms);
+		localtime_r(&end, &tme);
 
 		fprintf(stderr, "  %02d:%02d - %02d:%02d : %s\n", tms.tm_hour, tms.tm_min, tme.tm_hour, tme.tm_min, descriptors->_4d.name);
 #endif
@@ -940,7 +941,7 @@ bool decode::take_eit(const dvbpsi_eit_t * const p_eit)
 	table_id_to_eit_x(p_eit->i_table_id, &eit_x);
 #endif
 
-	return networks[p_eit->i_network_id].take_eit(p_eit, eit_x);
+	return (*networks)[p_eit->i_network_id].take_eit(p_eit, eit_x);
 }
 
 bool decode_network_service::take_eit(const dvbpsi_eit_t * const p_eit, uint8_t eit_x)
@@ -1007,8 +1008,9 @@ bool decode::take_eit(const dvbpsi_atsc_eit_t * const p_eit)
 				       name, sizeof(name));
 		//p_epg->text[0] = 0;
 
-		struct tm tms = *localtime( &start );
-		struct tm tme = *localtime( &end  );
+		struct tm tms, tme;
+		localtime_r(&start, &tms);
+		localtime_r(&end, &tme);
 		fprintf(stderr, "  %02d:%02d - %02d:%02d : %s\n", tms.tm_hour, tms.tm_min, tme.tm_hour, tme.tm_min, name );
 #endif
 		//FIXME: descriptors
@@ -1097,8 +1099,9 @@ void decode::dump_epg_event(const decoded_vct_channel_t *channel, const decoded_
 
 	//FIXME: descriptors
 
-	struct tm tms = *localtime( &start );
-	struct tm tme = *localtime( &end  );
+	struct tm tms, tme;
+	localtime_r(&start, &tms);
+	localtime_r(&end, &tme);
 	fprintf(stderr, "  %02d:%02d - %02d:%02d : %s\n", tms.tm_hour, tms.tm_min, tme.tm_hour, tme.tm_min, name );
 
 	if (reporter) {
@@ -1127,8 +1130,9 @@ void decode::dump_epg_event(const decoded_sdt_service_t *service, const decoded_
 
 	//FIXME: descriptors
 
-	struct tm tms = *localtime( &start );
-	struct tm tme = *localtime( &end  );
+	struct tm tms, tme;
+	localtime_r(&start, &tms);
+	localtime_r(&end, &tme);
 	fprintf(stderr, "  %02d:%02d - %02d:%02d : %s\n", tms.tm_hour, tms.tm_min, tme.tm_hour, tme.tm_min, event->name.c_str()/*, iter_eit->second.text.c_str()*/ );
 
 	if (reporter)
@@ -1161,8 +1165,9 @@ void decode::get_epg_event(const decoded_vct_channel_t *channel, const decoded_a
 #if 1
 	//FIXME: descriptors
 
-	struct tm tms = *localtime( &start );
-	struct tm tme = *localtime( &end  );
+	struct tm tms, tme;
+	localtime_r(&start, &tms);
+	localtime_r(&end, &tme);
 	fprintf(stderr, "  %02d:%02d - %02d:%02d : %s\n", tms.tm_hour, tms.tm_min, tme.tm_hour, tme.tm_min, name );
 #endif
 	unsigned char message[512];
@@ -1187,8 +1192,9 @@ void decode::get_epg_event(const decoded_sdt_service_t *service, const decoded_e
 #if 1
 	//FIXME: descriptors
 
-	struct tm tms = *localtime( &start );
-	struct tm tme = *localtime( &end  );
+	struct tm tms, tme;
+	localtime_r(&start, &tms);
+	localtime_r(&end, &tme);
 	fprintf(stderr, "  %02d:%02d - %02d:%02d : %s\n", tms.tm_hour, tms.tm_min, tme.tm_hour, tme.tm_min, event->name.c_str()/*, iter_eit->second.text.c_str()*/ );
 #endif
 
@@ -1246,8 +1252,9 @@ bool decode::get_epg_event_atsc(uint16_t source_id, time_t showtime, decoded_eve
 
 				//FIXME: descriptors
 
-				struct tm tms = *localtime( &start );
-				struct tm tme = *localtime( &end  );
+				struct tm tms, tme;
+				localtime_r(&start, &tms);
+				localtime_r(&end, &tme);
 				fprintf(stdout, "  %02d:%02d - %02d:%02d : %s\n", tms.tm_hour, tms.tm_min, tme.tm_hour, tme.tm_min, name );
 #endif
 				get_epg_event(&iter_vct->second, &iter_eit->second, e);
@@ -1305,8 +1312,9 @@ bool decode::get_epg_event_dvb(uint16_t service_id, time_t showtime, decoded_eve
 #if 1
 				//FIXME: descriptors
 
-				struct tm tms = *localtime( &start );
-				struct tm tme = *localtime( &end  );
+				struct tm tms, tme;
+				localtime_r(&start, &tms);
+				localtime_r(&end, &tme);
 				fprintf(stdout, "  %02d:%02d - %02d:%02d : %s\n", tms.tm_hour, tms.tm_min, tme.tm_hour, tme.tm_min, iter_eit->second.name.c_str()/*, iter_eit->second.text.c_str()*/ );
 #endif
 				get_epg_event(&iter_sdt->second, &iter_eit->second, e);
@@ -1376,8 +1384,9 @@ void decode::dump_eit_x_atsc(decode_report *reporter, uint8_t eit_x, uint16_t so
 
 			//FIXME: descriptors
 
-			struct tm tms = *localtime( &start );
-			struct tm tme = *localtime( &end  );
+			struct tm tms, tme;
+			localtime_r(&start, &tms);
+			localtime_r(&end, &tme);
 			fprintf(stdout, "  %02d:%02d - %02d:%02d : %s\n", tms.tm_hour, tms.tm_min, tme.tm_hour, tme.tm_min, name );
 #endif
 			dump_epg_event(&iter_vct->second, &iter_eit->second, reporter);
@@ -1418,8 +1427,9 @@ void decode::dump_eit_x_dvb(decode_report *reporter, uint8_t eit_x, uint16_t ser
 
 			//FIXME: descriptors
 
-			struct tm tms = *localtime( &start );
-			struct tm tme = *localtime( &end  );
+			struct tm tms, tme;
+			localtime_r(&start, &tms);
+			localtime_r(&end, &tme);
 			fprintf(stdout, "  %02d:%02d - %02d:%02d : %s\n", tms.tm_hour, tms.tm_min, tme.tm_hour, tme.tm_min, iter_eit->second.name.c_str()/*, iter_eit->second.text.c_str()*/ );
 #endif
 			dump_epg_event(&iter_sdt->second, &iter_eit->second, reporter);
@@ -1584,12 +1594,12 @@ bool decode::eit_x_complete_atsc(uint8_t current_eit_x)
 
 bool decode::eit_x_complete_dvb_pf()
 {
-	return networks.count(orig_network_id) ? networks[orig_network_id].eit_x_complete_dvb_pf(decoded_pat.ts_id) : false;
+	return networks->count(orig_network_id) ? (*networks)[orig_network_id].eit_x_complete_dvb_pf(decoded_pat.ts_id) : false;
 }
 
 bool decode::eit_x_complete_dvb_sched(uint8_t current_eit_x)
 {
-	return networks.count(orig_network_id) ? networks[orig_network_id].eit_x_complete_dvb_sched(decoded_pat.ts_id, current_eit_x) : false;
+	return networks->count(orig_network_id) ? (*networks)[orig_network_id].eit_x_complete_dvb_sched(decoded_pat.ts_id, current_eit_x) : false;
 }
 
 bool decode_network_service::eit_x_complete_dvb_pf()
@@ -1658,27 +1668,27 @@ bool decode::got_all_eit(int limit)
 
 const decode_network* decode::get_decoded_network()
 {
-	return networks.count(orig_network_id) ? &networks[orig_network_id] : NULL;
+	return networks->count(orig_network_id) ? &(*networks)[orig_network_id] : NULL;
 }
 
 uint16_t decode::get_lcn(uint16_t service_id)
 {
-	return networks.count(network_id) ? networks[network_id].descriptors.lcn[service_id]: 0;
+	return networks->count(network_id) ? (*networks)[network_id].descriptors.lcn[service_id]: 0;
 }
 
 const map_decoded_eit* decode::get_decoded_eit()
 {
-	return networks.count(orig_network_id) ? networks[orig_network_id].get_decoded_eit(decoded_pat.ts_id) : NULL;
+	return networks->count(orig_network_id) ? (*networks)[orig_network_id].get_decoded_eit(decoded_pat.ts_id) : NULL;
 }
 
 const decoded_sdt_t* decode::get_decoded_sdt()
 {
-	return networks.count(orig_network_id) ? networks[orig_network_id].get_decoded_sdt(decoded_pat.ts_id) : NULL;
+	return networks->count(orig_network_id) ? (*networks)[orig_network_id].get_decoded_sdt(decoded_pat.ts_id) : NULL;
 }
 
 const decoded_nit_t* decode::get_decoded_nit()
 {
-	return networks.count(network_id) ? networks[network_id].get_decoded_nit() : NULL;
+	return networks->count(network_id) ? (*networks)[network_id].get_decoded_nit() : NULL;
 }
 
 #if 0
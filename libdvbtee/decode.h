@@ -324,8 +324,6 @@ private:
 
 typedef std::map<uint16_t, decode_network> map_network_decoder;
 
-void clear_decoded_networks();
-
 typedef struct
 {
 	std::string channel_name;
@@ -429,11 +427,19 @@ public:
 
 	void set_physical_channel(unsigned int chan) { physical_channel = chan; }
 
+	/* NIT, SDT & DVB EIT data is kept per network rather than per
+	 * stream, so that it can be shared by the decoders of all streams
+	 * seen by one parser.  NULL reverts to a map of our own */
+	void set_networks(map_network_decoder *nw) { networks = (nw) ? nw : &local_networks; }
+
 	bool get_epg_event(uint16_t service_id, time_t showtime, decoded_event_t *e);
 private:
 	uint16_t orig_network_id;
 	uint16_t      network_id;
 
+	map_network_decoder *networks;
+	map_network_decoder local_networks;
+
 	time_t stream_time;
 
 	decoded_pat_t   decoded_pat;
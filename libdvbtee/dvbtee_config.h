@@ -32,6 +32,18 @@
 #endif
 #endif
 
+#ifdef HAVE_LINUX_IO_URING_H
+#if HAVE_LINUX_IO_URING_H
+#define USE_IO_URING
+#endif
+#endif
+
+#ifdef HAVE_SYS_EPOLL_H
+#if HAVE_SYS_EPOLL_H
+#define USE_EPOLL
+#endif
+#endif
+
 #ifdef HAVE_LIBHDHOMERUN_HDHOMERUN_H
 #if HAVE_LIBHDHOMERUN_HDHOMERUN_H
 #define USE_HDHOMERUN
@@ -19,14 +19,23 @@
  *
  *****************************************************************************/
 
+#include "dvbtee_config.h"
+
 #include <arpa/inet.h>
+#include <net/if.h>
 #include <sys/time.h>
+#include <sys/mman.h>
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+#endif
 #include <sys/resource.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/syscall.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -35,8 +44,6 @@
 #include "log.h"
 #define CLASS_MODULE "feed"
 
-#define FEED_BUFFER 0
-
 #define dprintf(fmt, arg...) __dprintf(DBG_FEED, fmt, ##arg)
 
 unsigned int dbg = 0;
@@ -54,24 +61,40 @@ feed::feed()
   , h_feed_thread((pthread_t)NULL)
   , f_kill_thread(false)
   , fd(-1)
-#if FEED_BUFFER
+  , buffer_size(0)
   , feed_thread_prio(100)
+  , f_buffered(false)
+  , f_mmap(true)
+  , read_size(FEED_READ_SIZE)
+  , udp_rcvbuf(FEED_UDP_RCVBUF)
+  , kernel_drops(0)
   , ringbuffer()
-#endif
+  , pace_speed(0)
+  , f_paced(false)
+  , f_loop(false)
+  , pace_phase(0)
+  , pace_pid(0xffff)
+  , pace_pcr(0)
+  , pace_last_pcr(0)
   , m_pull_iface(NULL)
+  , m_engine(NULL)
 {
 	dprintf("()");
 
 	memset(filename, 0, sizeof(filename));
-#if FEED_BUFFER
-	ringbuffer.set_capacity(BUFSIZE*4);
-#endif
+	memset(udp_iface, 0, sizeof(udp_iface));
 }
 
 feed::~feed()
 {
 	dprintf("(%s)", strlen(filename) ? filename : "");
 
+	if (m_engine)
+		m_engine->remove(this);
+	if (f_buffered) {
+		f_kill_thread = true;
+		stop_feed();
+	}
 	close_file();
 }
 
@@ -82,10 +105,23 @@ feed::feed(const feed&)
 	h_feed_thread = (pthread_t)NULL;
 	f_kill_thread = false;
 	fd = -1;
-#if FEED_BUFFER
+	buffer_size = 0;
 	feed_thread_prio = 100;
-#endif
+	f_buffered = false;
+	f_mmap = true;
+	read_size = FEED_READ_SIZE;
+	udp_rcvbuf = FEED_UDP_RCVBUF;
+	kernel_drops = 0;
+	memset(udp_iface, 0, sizeof(udp_iface));
+	pace_speed = 0;
+	f_paced = false;
+	f_loop = false;
+	pace_phase = 0;
+	pace_pid = 0xffff;
+	pace_pcr = 0;
+	pace_last_pcr = 0;
 	m_pull_iface = NULL;
+	m_engine = NULL;
 }
 
 feed& feed::operator= (const feed& cSource)
@@ -99,10 +135,23 @@ feed& feed::operator= (const feed& cSource)
 	h_feed_thread = (pthread_t)NULL;
 	f_kill_thread = false;
 	fd = -1;
-#if FEED_BUFFER
+	buffer_size = 0;
 	feed_thread_prio = 100;
-#endif
+	f_buffered = false;
+	f_mmap = true;
+	read_size = FEED_READ_SIZE;
+	udp_rcvbuf = FEED_UDP_RCVBUF;
+	kernel_drops = 0;
+	memset(udp_iface, 0, sizeof(udp_iface));
+	pace_speed = 0;
+	f_paced = false;
+	f_loop = false;
+	pace_phase = 0;
+	pace_pid = 0xffff;
+	pace_pcr = 0;
+	pace_last_pcr = 0;
 	m_pull_iface = NULL;
+	m_engine = NULL;
 
 	return *this;
 }
@@ -146,13 +195,16 @@ bool feed::check()
 	return true; //FIXME
 }
 
-#if FEED_BUFFER
+void feed::get_stats(rbuf_stats_t *s)
+{
+	ringbuffer.get_stats(s);
+}
+
 //static
 void* feed::feed_thread(void *p_this)
 {
 	return static_cast<feed*>(p_this)->feed_thread();
 }
-#endif
 
 //static
 void* feed::file_feed_thread(void *p_this)
@@ -160,12 +212,6 @@ void* feed::file_feed_thread(void *p_this)
 	return static_cast<feed*>(p_this)->file_feed_thread();
 }
 
-//static
-void* feed::stdin_feed_thread(void *p_this)
-{
-	return static_cast<feed*>(p_this)->stdin_feed_thread();
-}
-
 //static
 void* feed::tcp_client_feed_thread(void *p_this)
 {
@@ -184,40 +230,199 @@ void* feed::pull_thread(void *p_this)
 	return static_cast<feed*>(p_this)->pull_thread();
 }
 
-#if FEED_BUFFER
+/* must be called before the reader thread is created */
 int feed::start_feed()
 {
-#if 0
-	f_kill_thread = false;
-#endif
+	if ((f_buffered) || (buffer_size <= 0))
+		return 0;
+
+	ringbuffer.set_capacity(buffer_size, RBUF_MIRRORED);
+
 	int ret = pthread_create(&h_feed_thread, NULL, feed_thread, this);
 
-	if (0 != ret)
+	if (0 != ret) {
 		perror("pthread_create() failed");
+		ringbuffer.dealloc();
+	} else
+		f_buffered = true;
 
 	return ret;
 }
-#endif
+
+/* f_kill_thread must already be set */
+void feed::stop_feed()
+{
+	if (!f_buffered)
+		return;
+
+	ringbuffer.notify();
+	pthread_join(h_feed_thread, NULL);
+
+	f_buffered = false;
+}
 
 int feed::setup_feed(int prio)
 {
-#if FEED_BUFFER
 	feed_thread_prio = prio;
 
+	f_kill_thread = false;
+
 	return start_feed();
-#else
-	(void)prio;
-	return 0;
-#endif
 }
 
 int feed::push(int size, const uint8_t* data)
 {
-#if FEED_BUFFER
-	return (ringbuffer.write((const void*)data, size)) ? 0 : -1;
-#else
-	return parser.feed(size, (uint8_t*)data);
-#endif
+	if (!f_buffered)
+		return parse_data(size, data);
+
+	if (ringbuffer.write((const void*)data, size))
+		return 0;
+
+	ringbuffer.count_dropped(size);
+	return -1;
+}
+
+/* m2ts and 204 byte packets are cut down to 188 bytes on their way in */
+int feed::parse_data(int size, const uint8_t *data)
+{
+	const uint8_t *p = NULL;
+
+	size = normalizer.push(data, size, &p);
+
+	if (f_paced)
+		return pace_data(size, p);
+
+	return parser.feed(size, (uint8_t*)p);
+}
+
+/* don't bother sleeping for less, packets are handed on in batches */
+#define PACE_MIN_SLEEP_NS   (2*1000*1000LL)
+/* longest sleep before checking f_kill_thread again */
+#define PACE_MAX_SLEEP_NS   (100*1000*1000LL)
+/* a larger PCR jump, or falling this far behind, starts the clock afresh */
+#define PACE_MAX_GAP        (2*27000000LL)
+
+static inline int64_t timespec_ns(const struct timespec *t)
+{
+	return (int64_t)t->tv_sec * 1000000000LL + t->tv_nsec;
+}
+
+static inline bool pkt_pcr(const uint8_t *p, uint64_t *pcr)
+{
+	if ((!(p[3] & 0x20)) || (p[4] < 7) || (!(p[5] & 0x10)))
+		return false;
+
+	uint64_t base = ((uint64_t)p[6] << 25) | (p[7] << 17) | (p[8] << 9) | (p[9] << 1) | (p[10] >> 7);
+
+	*pcr = base * 300 + (((p[10] & 0x01) << 8) | p[11]);
+	return true;
+}
+
+/* hands the data to the parser no sooner than the PCR of the first
+ * stream that carries one says it is due */
+int feed::pace_data(int size, const uint8_t *data)
+{
+	uint8_t *p = (uint8_t*)data;
+	int fed = 0;
+	int i = (188 - pace_phase) % 188;
+
+	if (i > size) {
+		pace_phase += size;
+		return parser.feed(size, p);
+	}
+
+	for (; i + 188 <= size; i += 188) {
+		uint64_t pcr;
+
+		if (p[i] != 0x47) {
+			i += ts_sync_offset(p + i, size - i) - 188;
+			continue;
+		}
+		if ((f_kill_thread) || (!pkt_pcr(p + i, &pcr)))
+			continue;
+
+		uint16_t pid = ((p[i+1] & 0x1f) << 8) | p[i+2];
+		if (pace_pid == 0xffff)
+			pace_pid = pid;
+		else if (pid != pace_pid)
+			continue;
+
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+
+		/* the first PCR, a discontinuity or a loop */
+		bool reset = ((!pace_last_pcr) || (pcr < pace_last_pcr) || (pcr < pace_pcr) ||
+			      (pcr - pace_last_pcr > PACE_MAX_GAP));
+		int64_t due = 0;
+
+		if (!reset) {
+			due = timespec_ns(&pace_start) + (int64_t)((pcr - pace_pcr) / 0.027 / pace_speed);
+			/* or we can't keep up */
+			reset = (timespec_ns(&now) - due > PACE_MAX_GAP / 27 * 1000);
+		}
+		if (reset) {
+			pace_start = now;
+			pace_pcr = pcr;
+			due = timespec_ns(&now);
+		}
+		pace_last_pcr = pcr;
+
+		if (due - timespec_ns(&now) < PACE_MIN_SLEEP_NS)
+			continue;
+
+		/* everything up to this packet goes out now, the rest when due */
+		parser.feed(i - fed, p + fed);
+		fed = i;
+
+		while ((!f_kill_thread) && (due - timespec_ns(&now) > 0)) {
+			int64_t ns = due - timespec_ns(&now);
+			if (ns > PACE_MAX_SLEEP_NS)
+				ns = timespec_ns(&now) + PACE_MAX_SLEEP_NS;
+			else
+				ns = due;
+
+			struct timespec t;
+			t.tv_sec = ns / 1000000000LL;
+			t.tv_nsec = ns % 1000000000LL;
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL);
+			clock_gettime(CLOCK_MONOTONIC, &now);
+		}
+	}
+	pace_phase = (i < size) ? size - i : 0;
+
+	return parser.feed(size - fed, p + fed);
+}
+
+int feed::get_write_ptr(void **q, uint8_t *local, int size, bool lossy)
+{
+	while (f_buffered) {
+		if (ringbuffer.get_write_ptr(q) >= size)
+			return size;
+
+		/* drop rather than stall a lossy reader, and fall back to
+		 * write() when the free space is split at the wrap */
+		if ((lossy) || (f_kill_thread) ||
+		    (ringbuffer.get_capacity() - ringbuffer.get_size() >= size))
+			break;
+
+		ringbuffer.wait_for_space(size, 100);
+	}
+	*q = local;
+
+	return size;
+}
+
+void feed::put_write_ptr(void *q, uint8_t *local, int size)
+{
+	if (size <= 0)
+		return;
+
+	if (!f_buffered)
+		parse_data(size, local);
+	else if (q != local)
+		ringbuffer.put_write_ptr(size);
+	else if (!ringbuffer.write(local, size))
+		ringbuffer.count_dropped(size);
 }
 
 int feed::pull(feed_pull_iface *iface)
@@ -228,6 +433,8 @@ int feed::pull(feed_pull_iface *iface)
 
 	strncpy(filename, "PULLCALLBACK", sizeof(filename));
 
+	start_feed();
+
 	int ret = pthread_create(&h_thread, NULL, pull_thread, this);
 
 	if (0 != ret)
@@ -241,14 +448,24 @@ int feed::start()
 {
 	f_kill_thread = false;
 
+	f_paced = (pace_speed > 0);
+	pace_phase = 0;
+	pace_pid = 0xffff;
+	pace_last_pcr = 0;
+
+	/* the engine neither paces nor loops */
+	if ((m_engine) && (!f_paced) && (!f_loop) && (0 == m_engine->add(this, fd, URING_FILE)))
+		return 0;
+
+	start_feed();
+
 	int ret = pthread_create(&h_thread, NULL, file_feed_thread, this);
 
-	if (0 != ret)
+	if (0 != ret) {
 		perror("pthread_create() failed");
-#if FEED_BUFFER
-	else
-		start_feed();
-#endif
+		stop_without_wait();
+		stop_feed();
+	}
 	return ret;
 }
 
@@ -262,20 +479,24 @@ void feed::stop()
 #endif
 	listener.stop();
 
+	if (m_engine)
+		m_engine->remove(this);
+
 	dprintf("waiting...");
 
 	while (-1 != fd) {
 		usleep(20*1000);
 	}
 
+	stop_feed();
+
 	dprintf("done");
 }
 
-#if FEED_BUFFER
 void *feed::feed_thread()
 {
 	unsigned char *data = NULL;
-	int size, read_size;
+	int size;
 
 	if (feed_thread_prio != 100) {
 		pid_t tid = syscall(SYS_gettid);
@@ -287,46 +508,152 @@ void *feed::feed_thread()
 		}
 	}
 	dprintf("()");
-	while (!f_kill_thread) {
-		size = ringbuffer.get_size();
-		if (size >= 188) {
-			if (size != (size/188)*188) fprintf(stderr,"%s: ringbuf has unaligned data %d -> %d\t", __func__, size, (size/188)*188);
-			size = (size/188)*188;
-			read_size = ringbuffer.get_read_ptr((void**)&data, size);
-			//if ((read_size != size) && (size != (size/read_size)*read_size)) fprintf(stderr,"%s: read size doesnt match ringbuffer size, shouldnt be %d != %d\n", __func__, read_size, size);
-			parser.feed(read_size, data);
-			ringbuffer.put_read_ptr(read_size);
-		} else
-			usleep(20*1000);
+	/* whatever the reader left behind is still parsed after it stops */
+	while ((!f_kill_thread) || (ringbuffer.get_size() > 0)) {
+		if ((!ringbuffer.wait_for_size(188, 100)) && (!f_kill_thread))
+			continue;
+		/* split packets are reassembled by the parser, so take
+		 * everything up to the end of the ring as it is */
+		size = ringbuffer.get_read_ptr((void**)&data, ringbuffer.get_size());
+		if (size <= 0)
+			continue;
+		parse_data(size, data);
+		ringbuffer.put_read_ptr(size);
 	}
 	pthread_exit(NULL);
 }
+
+/* mapped a window at a time, so that 32 bit hosts cope with large files */
+#define FEED_MMAP_WINDOW (64*1024*1024)
+#define FEED_MMAP_SPAN   (188*4096)
+
+/* returns false if the file could not be mapped, with the file
+ * position left where reading should carry on from */
+bool feed::map_file()
+{
+	struct stat st;
+	off_t pos, base, page = sysconf(_SC_PAGESIZE);
+	int span = FEED_MMAP_SPAN;
+
+	if ((fstat(fd, &st) < 0) || (!S_ISREG(st.st_mode)) ||
+	    ((pos = lseek(fd, 0, SEEK_CUR)) < 0))
+		return false;
+
+	/* a span has to fit in the parser ring with room to spare */
+	if ((f_buffered) && (span > ringbuffer.get_capacity() / 2))
+		span = (ringbuffer.get_capacity() / 2 / 188) * 188;
+	if (span < 188)
+		return false;
+#ifdef POSIX_FADV_SEQUENTIAL
+	posix_fadvise(fd, pos, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+	while ((!f_kill_thread) && (pos < st.st_size)) {
+		base = pos & ~(page - 1);
+
+		size_t maplen = ((st.st_size - base) < FEED_MMAP_WINDOW) ? st.st_size - base : FEED_MMAP_WINDOW;
+		bool eof = (base + (off_t)maplen == st.st_size);
+
+		/* private and writable, the parser may touch the packets it is given */
+		uint8_t *map = (uint8_t*)mmap(NULL, maplen, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, base);
+		if (map == MAP_FAILED) {
+			perror("mmap failed");
+			lseek(fd, pos, SEEK_SET);
+			return false;
+		}
+		madvise(map, maplen, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+		madvise(map, maplen, MADV_HUGEPAGE);
 #endif
+		uint8_t *p = map + (pos - base);
+		uint8_t *end = map + maplen;
+
+		while ((!f_kill_thread) && (p < end)) {
+			void *q = NULL;
+			int size = ((end - p) < span) ? (int)(end - p) : span;
+
+			/* a packet split by the end of the window waits for the next
+			 * one, only a partial packet at the end of the file is fed */
+			if (size >= 188)
+				size -= size % 188;
+			else if (!eof)
+				break;
+
+			size = get_write_ptr(&q, p, size, false);
+			if (q != p)
+				memcpy(q, p, size);
+			put_write_ptr(q, p, size);
+
+			p += size;
+		}
+		pos = base + (p - map);
+
+		munmap(map, maplen);
+
+		if ((f_loop) && (pos >= st.st_size))
+			pos = 0;
+	}
+	f_kill_thread = true;
+
+	return true;
+}
+
+int feed::parse_file()
+{
+	if (fd < 0)
+		return -1;
+
+	f_kill_thread = false;
+	f_paced = false;
+
+	start_feed();
+	read_file();
+	stop_feed();
+
+	return 0;
+}
 
 void *feed::file_feed_thread()
+{
+	read_file();
+	pthread_exit(NULL);
+}
+
+void feed::read_file()
 {
 	ssize_t r;
-#if FEED_BUFFER
+	unsigned char *buf = NULL;
 	void *q = NULL;
-#else
-	unsigned char q[BUFSIZE];
-#endif
 	int available;
 
 	dprintf("(fd=%d)", fd);
 
+	if ((f_mmap) && (map_file())) {
+		close_file();
+		return;
+	}
+#ifdef F_SETPIPE_SZ
+	/* a deeper pipe lets each read return more */
+	fcntl(fd, F_SETPIPE_SZ, read_size);
+#endif
+	int chunk = read_size;
+	if ((f_buffered) && (chunk > ringbuffer.get_capacity() / 2))
+		chunk = ringbuffer.get_capacity() / 2;
+
+	buf = new unsigned char[chunk];
+
 	while (!f_kill_thread) {
+		/* so that an idle pipe doesn't hold up stop() */
+		struct pollfd pfd = { fd, POLLIN, 0 };
+		if (0 == poll(&pfd, 1, 100))
+			continue;
 
-#if FEED_BUFFER
-		available = ringbuffer.get_write_ptr(&q);
-#else
-		available = sizeof(q);
-#endif
-		available = (available < BUFSIZE) ? available : BUFSIZE;
+		available = get_write_ptr(&q, buf, chunk, false);
 		if ((r = read(fd, q, available)) <= 0) {
 
 			if (!r) {
-				f_kill_thread = true;
+				/* fails for pipes, which just end */
+				if ((!f_loop) || (lseek(fd, 0, SEEK_SET) < 0))
+					f_kill_thread = true;
 				continue;
 			}
 			switch (errno) {
@@ -365,54 +692,10 @@ void *feed::file_feed_thread()
 			}
 			continue;
 		}
-#if FEED_BUFFER
-		ringbuffer.put_write_ptr(r);
-#else
-		parser.feed(r, q);
-#endif
+		put_write_ptr(q, buf, r);
 	}
+	delete[] buf;
 	close_file();
-	pthread_exit(NULL);
-}
-
-void *feed::stdin_feed_thread()
-{
-	ssize_t r;
-#if FEED_BUFFER
-	void *q = NULL;
-#else
-	unsigned char q[BUFSIZE];
-#endif
-	int available;
-
-	dprintf("()");
-
-	while (!f_kill_thread) {
-
-#if FEED_BUFFER
-		available = ringbuffer.get_write_ptr(&q);
-#else
-		available = sizeof(q);
-#endif
-		available = (available < BUFSIZE) ? available : BUFSIZE;
-		if ((r = fread(q, 188, available / 188, stdin)) < (available / 188)) {
-			if (ferror(stdin)) {
-				fprintf(stderr, "%s: error reading stdin!\n", __func__);
-				usleep(50*1000);
-				clearerr(stdin);
-			}
-			if (feof(stdin)) {
-				fprintf(stderr, "%s: EOF\n", __func__);
-				f_kill_thread = true;
-			}
-		}
-#if FEED_BUFFER
-		ringbuffer.put_write_ptr(r * 188);
-#else
-		parser.feed(r * 188, q);
-#endif
-	}
-	pthread_exit(NULL);
 }
 
 void *feed::pull_thread()
@@ -432,65 +715,118 @@ void *feed::tcp_client_feed_thread()
 //	struct sockaddr_in tcpsa;
 //	socklen_t salen = sizeof(tcpsa);
 	int rxlen = 0;
-#if FEED_BUFFER
+	unsigned char buf[BUFSIZE];
 	void *q = NULL;
-#else
-	unsigned char q[BUFSIZE];
-#endif
 	int available;
 
 	dprintf("(sock_fd=%d)", fd);
 
 //	getpeername(fd, (struct sockaddr*)&tcpsa, &salen);
 
+	struct pollfd pfd;
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+
+	/* take whatever has arrived, the parser reassembles split packets */
 	while (!f_kill_thread) {
-#if FEED_BUFFER
-		available = ringbuffer.get_write_ptr(&q);
-#else
-		available = sizeof(q);
-#endif
-		available = (available < (BUFSIZE)) ? available : (BUFSIZE);
-		rxlen = recv(fd, q, available, MSG_WAITALL);
-		if (rxlen > 0) {
-			if (rxlen != available) fprintf(stderr, "%s: %d bytes != %d\n", __func__, rxlen, available);
-#if !FEED_BUFFER
-			parser.feed(rxlen, q);
-#endif
-		} else if ( (rxlen == 0) || ( (rxlen == -1) && (errno != EAGAIN) ) ) {
+		if (poll(&pfd, 1, 100) <= 0)
+			continue;
+		available = get_write_ptr(&q, buf, sizeof(buf), false);
+		rxlen = recv(fd, q, available, MSG_DONTWAIT);
+		if ( (rxlen == 0) || ( (rxlen == -1) && (errno != EAGAIN) && (errno != EINTR) ) )
 			stop_without_wait();
-		} else if (rxlen == -1) { //( (rxlen == -1) && (errno == EAGAIN) ) {
+		put_write_ptr(q, buf, rxlen);
+	}
+	close_file();
+	pthread_exit(NULL);
+}
+
+#ifdef MSG_WAITFORONE
+#define UDP_BATCH 32
+#define UDP_DGRAM (188*7)
+
+/* one recvmmsg() per batch of up to UDP_BATCH datagrams, received into
+ * packet aligned slots and handed to the parser in one piece */
+void *feed::udp_listen_feed_thread()
+{
+	unsigned char buf[UDP_BATCH * UDP_DGRAM];
+	struct mmsghdr msgs[UDP_BATCH];
+	struct iovec iovecs[UDP_BATCH];
+	/* room for the SO_RXQ_OVFL drop counter of each datagram */
+	char cmsgbuf[UDP_BATCH][CMSG_SPACE(sizeof(uint32_t))];
+	void *q = NULL;
+	int i, n, rxlen;
+
+	dprintf("(sock_fd=%d)", fd);
+
+	while (!f_kill_thread) {
+
+		/* a batch the parser thread has no room for is dropped,
+		 * stalling here would only lose it in the kernel instead */
+		get_write_ptr(&q, buf, sizeof(buf), true);
+
+		for (i = 0; i < UDP_BATCH; i++) {
+			iovecs[i].iov_base = (uint8_t*)q + i * UDP_DGRAM;
+			iovecs[i].iov_len  = UDP_DGRAM;
+			memset(&msgs[i], 0, sizeof(msgs[i]));
+			msgs[i].msg_hdr.msg_iov        = &iovecs[i];
+			msgs[i].msg_hdr.msg_iovlen     = 1;
+			msgs[i].msg_hdr.msg_control    = cmsgbuf[i];
+			msgs[i].msg_hdr.msg_controllen = sizeof(cmsgbuf[i]);
+		}
+
+		n = recvmmsg(fd, msgs, UDP_BATCH, MSG_WAITFORONE, NULL);
+		if ( (n == 0) || ( (n == -1) && (errno != EAGAIN) ) ) {
+			stop_without_wait();
+			continue;
+		} else if (n == -1) {
 			usleep(50*1000);
+			continue;
 		}
-#if FEED_BUFFER
-		ringbuffer.put_write_ptr((rxlen > 0) ? rxlen : 0);
+
+		/* close up the gaps left by short datagrams */
+		for (rxlen = 0, i = 0; i < n; i++) {
+			if (rxlen != i * UDP_DGRAM)
+				memmove((uint8_t*)q + rxlen, iovecs[i].iov_base, msgs[i].msg_len);
+			rxlen += msgs[i].msg_len;
+#ifdef SO_RXQ_OVFL
+			for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cmsg; cmsg = CMSG_NXTHDR(&msgs[i].msg_hdr, cmsg)) {
+				uint32_t drops;
+
+				if ((cmsg->cmsg_level != SOL_SOCKET) || (cmsg->cmsg_type != SO_RXQ_OVFL))
+					continue;
+
+				/* a running total for the socket */
+				memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+				if (drops != kernel_drops) {
+					dprintf("(sock_fd=%d) %u datagrams dropped by the kernel", fd, drops - kernel_drops);
+					kernel_drops = drops;
+				}
+			}
 #endif
+		}
+		put_write_ptr(q, buf, rxlen);
 	}
 	close_file();
 	pthread_exit(NULL);
 }
-
+#else
 void *feed::udp_listen_feed_thread()
 {
 //	struct sockaddr_in udpsa;
 //	socklen_t salen = sizeof(udpsa);
 	int rxlen = 0;
-#if FEED_BUFFER
+	unsigned char buf[188*7];
 	void *q = NULL;
-#else
-	unsigned char q[188*7];
-#endif
 	int available;
 
 	dprintf("(sock_fd=%d)", fd);
 
 	while (!f_kill_thread) {
 
-#if FEED_BUFFER
-		available = ringbuffer.get_write_ptr(&q);
-#else
-		available = sizeof(q);
-#endif
-		available = (available < (188*7)) ? available : (188*7);
+		/* a datagram the parser thread has no room for is dropped,
+		 * stalling here would only lose it in the kernel instead */
+		available = get_write_ptr(&q, buf, sizeof(buf), true);
 		//ssize_t recvfrom(int sockfd, void *buf, size_t len, int flags, struct sockaddr *src_addr, socklen_t *addrlen);
 		rxlen = recvfrom(fd, q, available, MSG_WAITALL, NULL, NULL);//(struct sockaddr*) &ip_addr, sizeof(ip_addr));
 		if (rxlen > 0) {
@@ -498,44 +834,35 @@ void *feed::udp_listen_feed_thread()
 			if (rxlen != available) fprintf(stderr, "%s: %d bytes != %d\n", __func__, rxlen, available);
 #endif
 //			getpeername(fd, (struct sockaddr*)&udpsa, &salen);
-#if !FEED_BUFFER
-			parser.feed(rxlen, q);
-#endif
 		} else if ( (rxlen == 0) || ( (rxlen == -1) && (errno != EAGAIN) ) ) {
 			stop_without_wait();
 		} else if (rxlen == -1) { //( (rxlen == -1) && (errno == EAGAIN) ) {
 			usleep(50*1000);
 		}
-#if FEED_BUFFER
-		ringbuffer.put_write_ptr((rxlen > 0) ? rxlen : 0);
-#endif
+		put_write_ptr(q, buf, rxlen);
 	}
 	close_file();
 	pthread_exit(NULL);
 }
+#endif
 
+/* read like any other file, so that a redirected file is mapped and
+ * a pipe is read in read_size chunks straight into the parser's buffer */
 int feed::start_stdin()
 {
 	dprintf("()");
 
-	if (NULL == freopen(NULL, "rb", stdin)) {
+	int stdin_fd = dup(STDIN_FILENO);
+	if (stdin_fd < 0) {
 		fprintf(stderr, "failed to open stdin!\n");
 		return -1;
 	}
 	fprintf(stderr, "%s: using STDIN\n", __func__);
 	strncpy(filename, "STDIN", sizeof(filename));
 
-	f_kill_thread = false;
-
-	int ret = pthread_create(&h_thread, NULL, stdin_feed_thread, this);
+	fd = stdin_fd;
 
-	if (0 != ret)
-		perror("pthread_create() failed");
-#if FEED_BUFFER
-	else
-		start_feed();
-#endif
-	return ret;
+	return start();
 }
 
 int feed::start_socket(char* source)
@@ -544,7 +871,7 @@ int feed::start_socket(char* source)
 #if 0
 	struct sockaddr_in ip_addr;
 #endif
-	char *ip, *portnum, *save;
+	char *ip, *portnum, *save, *group = NULL, *src = NULL, *ifname;
 	uint16_t port = 0;
 	bool b_tcp = false;
 	bool b_udp = false;
@@ -570,9 +897,14 @@ int feed::start_socket(char* source)
 		}
 		// else ip = proto;
 		portnum = strtok_r(NULL, ":", &save);
-		if (portnum)
+		if (portnum) {
 			port = atoi(portnum);
 
+			/* udp://[source@]group:port?iface=eth0 */
+			if ((ifname = strstr(portnum, "?iface=")))
+				set_udp_interface(ifname + strlen("?iface="));
+		}
+
 		if (!port) {
 			port = atoi(ip);
 			ip = NULL;
@@ -599,7 +931,15 @@ int feed::start_socket(char* source)
 		} else
 			ringbuffer.reset();
 #endif
-		ret = (b_tcp) ? start_tcp_listener(port) : start_udp_listener(port);
+	if ((b_udp) && (ip)) {
+		group = strchr(ip, '@');
+		if (group) {
+			*group++ = '\0';
+			src = ip;
+		} else
+			group = ip;
+	}
+		ret = (b_tcp) ? start_tcp_listener(port) : start_udp_listener(port, group, src);
 #if 0
 	} else {
 		perror("socket failed");
@@ -629,18 +969,23 @@ void feed::add_tcp_feed(int socket)
 
 	f_kill_thread = false;
 
+	normalizer.reset();
+
 	if (0 != getpeername(fd, (struct sockaddr*)&tcpsa, &salen)) {
 		perror("getpeername() failed");
 		goto fail_close_file;
 	}
 
+	if ((m_engine) && (0 == m_engine->add(this, fd, URING_STREAM)))
+		return;
+
+	start_feed();
+
 	if (0 != pthread_create(&h_thread, NULL, tcp_client_feed_thread, this)) {
 		perror("pthread_create() failed");
+		stop_without_wait();
+		stop_feed();
 		goto fail_close_file;
-#if FEED_BUFFER
-	} else {
-		start_feed();
-#endif
 	}
 	return;
 fail_close_file:
@@ -648,6 +993,76 @@ fail_close_file:
 	return;
 }
 
+int feed::attach_socket(int socket)
+{
+	dprintf("(%d)", socket);
+	if (fd >= 0) {
+		dprintf("(%d) already attached to %d", socket, fd);
+		return -1;
+	}
+
+	int fl = fcntl(socket, F_GETFL, 0);
+	if (fcntl(socket, F_SETFL, fl | O_NONBLOCK) < 0) {
+		perror("set non-blocking failed");
+		return -1;
+	}
+
+	sprintf(filename, "TCPSOCKET: %d", socket);
+
+	fd = socket;
+
+	f_kill_thread = false;
+
+	normalizer.reset();
+
+	start_feed();
+
+	return 0;
+}
+
+int feed::read_socket(uint8_t *buf, int size)
+{
+	void *q = NULL;
+
+	if (fd < 0)
+		return -1;
+
+	/* never stall the other connections of the event loop, and never
+	 * take more than fits: what is left in the socket slows the sender */
+	if (f_buffered) {
+		int room = ringbuffer.get_capacity() - ringbuffer.get_size();
+		if (room < 188)
+			return 0;
+		if (size > room)
+			size = room;
+	}
+	size = get_write_ptr(&q, buf, size, false);
+
+	int rxlen = recv(fd, q, size, MSG_DONTWAIT);
+	if (rxlen == 0)
+		return -1;
+	if (rxlen < 0)
+		return ((errno == EAGAIN) || (errno == EINTR)) ? 0 : -1;
+
+	put_write_ptr(q, buf, rxlen);
+
+	return rxlen;
+}
+
+bool feed::is_backlogged()
+{
+	return (f_buffered) && (ringbuffer.get_capacity() - ringbuffer.get_size() < 188);
+}
+
+void feed::detach_socket()
+{
+	dprintf("(%d)", fd);
+
+	f_kill_thread = true;
+	stop_feed();
+	close_file();
+}
+
 int feed::start_tcp_listener(uint16_t port_requested)
 {
 	dprintf("(%d)", port_requested);
@@ -662,15 +1077,36 @@ int feed::start_tcp_listener(uint16_t port_requested)
 	return listener.start(port_requested);
 }
 
-int feed::start_udp_listener(uint16_t port_requested)
+void feed::set_udp_interface(const char *ifname)
+{
+	memset(udp_iface, 0, sizeof(udp_iface));
+	if (ifname)
+		strncpy(udp_iface, ifname, sizeof(udp_iface)-1);
+}
+
+int feed::start_udp_listener(uint16_t port_requested, const char *group, const char *source)
 {
 	struct sockaddr_in udp_sock;
+	struct in_addr group_addr, source_addr;
+	bool b_multicast = false;
 
 	dprintf("(%d)", port_requested);
 	sprintf(filename, "UDPLISTEN: %d", port_requested);
 
 	memset(&udp_sock, 0, sizeof(udp_sock));
 
+	if ((group) && (inet_aton(group, &group_addr)) &&
+	    (IN_MULTICAST(ntohl(group_addr.s_addr)))) {
+		b_multicast = true;
+
+		if ((source) && (!inet_aton(source, &source_addr))) {
+			fprintf(stderr, "%s: invalid source address %s\n", __func__, source);
+			return -1;
+		}
+		snprintf(filename, sizeof(filename), "UDPLISTEN: %s%s%s:%d",
+			 (source) ? source : "", (source) ? "@" : "", group, port_requested);
+	}
+
 	f_kill_thread = false;
 
 	fd = -1;
@@ -686,15 +1122,86 @@ int feed::start_udp_listener(uint16_t port_requested)
 		perror("setting reuse failed");
 		return -1;
 	}
+#ifdef SO_REUSEPORT
+	/* so that several feeds may listen to the same port */
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) < 0)
+		perror("setting reuseport failed");
+#endif
+
+	if (udp_rcvbuf > 0) {
+		int actual = 0;
+		socklen_t len = sizeof(actual);
+
+		/* SO_RCVBUFFORCE may exceed rmem_max, given CAP_NET_ADMIN */
+		if (
+#ifdef SO_RCVBUFFORCE
+		    (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &udp_rcvbuf, sizeof(udp_rcvbuf)) < 0) &&
+#endif
+		    (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &udp_rcvbuf, sizeof(udp_rcvbuf)) < 0))
+			perror("setting receive buffer size failed");
+
+		if (0 == getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &actual, &len))
+			dprintf("receive buffer is %d bytes, %d requested", actual, udp_rcvbuf);
+	}
+#ifdef SO_RXQ_OVFL
+	int ovfl = 1;
+	if (setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &ovfl, sizeof(ovfl)) < 0)
+		perror("enabling drop reporting failed");
+	kernel_drops = 0;
+#endif
 
 	udp_sock.sin_family = AF_INET;
 	udp_sock.sin_port = htons(port_requested);
-	udp_sock.sin_addr.s_addr = INADDR_ANY;
+	/* bound to the group, so that other groups on this port stay out */
+	udp_sock.sin_addr.s_addr = (b_multicast) ? group_addr.s_addr : INADDR_ANY;
 
 	if (bind(fd, (struct sockaddr*)&udp_sock, sizeof(udp_sock)) < 0) {
 		perror("bind to local interface failed");
 		return -1;
 	}
+
+	if (b_multicast) {
+		unsigned int ifindex = 0;
+
+		if ((strlen(udp_iface)) && (0 == (ifindex = if_nametoindex(udp_iface)))) {
+			perror("multicast interface lookup failed");
+			return -1;
+		}
+		if (source) {
+			struct group_source_req gsr;
+			struct sockaddr_in *sin;
+
+			memset(&gsr, 0, sizeof(gsr));
+			gsr.gsr_interface = ifindex;
+			sin = (struct sockaddr_in *)&gsr.gsr_group;
+			sin->sin_family = AF_INET;
+			sin->sin_addr = group_addr;
+			sin = (struct sockaddr_in *)&gsr.gsr_source;
+			sin->sin_family = AF_INET;
+			sin->sin_addr = source_addr;
+
+			if (setsockopt(fd, IPPROTO_IP, MCAST_JOIN_SOURCE_GROUP, &gsr, sizeof(gsr)) < 0) {
+				perror("source specific multicast join failed");
+				return -1;
+			}
+		} else {
+			struct group_req gr;
+			struct sockaddr_in *sin;
+
+			memset(&gr, 0, sizeof(gr));
+			gr.gr_interface = ifindex;
+			sin = (struct sockaddr_in *)&gr.gr_group;
+			sin->sin_family = AF_INET;
+			sin->sin_addr = group_addr;
+
+			if (setsockopt(fd, IPPROTO_IP, MCAST_JOIN_GROUP, &gr, sizeof(gr)) < 0) {
+				perror("multicast join failed");
+				return -1;
+			}
+		}
+		dprintf("joined %s%s%s on %s", (source) ? source : "", (source) ? "@" : "",
+			group, (strlen(udp_iface)) ? udp_iface : "the default interface");
+	}
 	//	port = port_requested;
 #if 0
 	int fl = fcntl(fd, F_GETFL, 0);
@@ -703,14 +1210,18 @@ int feed::start_udp_listener(uint16_t port_requested)
 		return -1;
 	}
 #endif
+	if ((m_engine) && (0 == m_engine->add(this, fd, URING_DGRAM)))
+		return 0;
+
+	start_feed();
+
 	int ret = pthread_create(&h_thread, NULL, udp_listen_feed_thread, this);
 
-	if (0 != ret)
+	if (0 != ret) {
 		perror("pthread_create() failed");
-#if FEED_BUFFER
-	else
-		start_feed();
-#endif
+		stop_without_wait();
+		stop_feed();
+	}
 	return ret;
 }
 
@@ -745,19 +1256,71 @@ bool feed::wait_for_event_or_timeout(unsigned int timeout, unsigned int wait_eve
 
 feed_server::feed_server()
   : m_iface(NULL)
+  , buffer_size(0)
+  , h_thread((pthread_t)NULL)
+  , f_kill_thread(false)
+  , epoll_fd(-1)
 {
 	dprintf("()");
 
 	feeders.clear();
+	conns.clear();
+
+	pthread_mutex_init(&mutex, 0);
 }
 
 feed_server::~feed_server()
 {
 	dprintf("()");
 
-	listener.stop();
+	stop();
 
 	feeders.clear();
+
+	pthread_mutex_destroy(&mutex);
+}
+
+feed_server::feed_server(const feed_server&)
+{
+	dprintf("(copy)");
+
+	m_iface = NULL;
+	buffer_size = 0;
+	h_thread = (pthread_t)NULL;
+	f_kill_thread = false;
+	epoll_fd = -1;
+
+	pthread_mutex_init(&mutex, 0);
+}
+
+feed_server& feed_server::operator= (const feed_server& cSource)
+{
+	dprintf("(operator=)");
+
+	if (this == &cSource)
+		return *this;
+
+	m_iface = NULL;
+	buffer_size = 0;
+	h_thread = (pthread_t)NULL;
+	f_kill_thread = false;
+	epoll_fd = -1;
+
+	return *this;
+}
+
+void feed_server::stop()
+{
+	dprintf("()");
+
+	f_kill_thread = true;
+
+	if (h_thread) {
+		pthread_join(h_thread, NULL);
+		h_thread = (pthread_t)NULL;
+	}
+
+	listener.stop();
 }
 
 void feed_server::add_tcp_feed(int socket)
@@ -765,6 +1328,7 @@ void feed_server::add_tcp_feed(int socket)
 	if (socket >= 0) {
 		dprintf("(%d)", socket);
 
+		feeders[socket].set_buffer_size(buffer_size);
 		feeders[socket].add_tcp_feed(socket);
 
 		if (m_iface) m_iface->add_feeder(&feeders[socket]);
@@ -776,15 +1340,265 @@ int feed_server::start_tcp_listener(uint16_t port_requested, feed_server_iface *
 {
 	dprintf("(%d)", port_requested);
 
-	/* set listener callback to notify us (feed_server) of new connections */
-	listener.set_interface(this);
-
 	/* set connection notify callback to notify parent server of new feeds */
 	m_iface = iface;
 
+	if (0 == start_epoll(port_requested))
+		return 0;
+
+	/* set listener callback to notify us (feed_server) of new connections */
+	listener.set_interface(this);
+
 	return listener.start(port_requested);
 }
 
+void feed_server::get_conn_stats(feed_conn_stats_map &stats)
+{
+	pthread_mutex_lock(&mutex);
+
+	stats = conns;
+
+	for (feed_conn_stats_map::iterator iter = stats.begin(); iter != stats.end(); ++iter) {
+		rbuf_stats_t s;
+		feeders[iter->first].get_stats(&s);
+		iter->second.bytes_dropped = s.bytes_dropped;
+	}
+
+	pthread_mutex_unlock(&mutex);
+}
+
+#ifdef USE_EPOLL
+#define FEED_SERVER_EVENTS 64
+/* reads per connection and wakeup, so that one busy upload can't starve the rest */
+#define FEED_SERVER_READS  8
+#define FEED_SERVER_RXBUF  (188*256)
+
+int feed_server::start_epoll(uint16_t port_requested)
+{
+	struct epoll_event ev;
+
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0) {
+		perror("epoll_create1() failed");
+		return -1;
+	}
+
+	if (listener.open_socket(port_requested, FEED_SERVER_BACKLOG) < 0)
+		goto fail;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = listener.get_socket();
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ev.data.fd, &ev) < 0) {
+		perror("epoll_ctl() failed");
+		goto fail;
+	}
+
+	f_kill_thread = false;
+
+	if (0 != pthread_create(&h_thread, NULL, epoll_thread, this)) {
+		perror("pthread_create() failed");
+		h_thread = (pthread_t)NULL;
+		goto fail;
+	}
+	return 0;
+fail:
+	listener.stop();
+	close(epoll_fd);
+	epoll_fd = -1;
+	return -1;
+}
+
+//static
+void* feed_server::epoll_thread(void *p_this)
+{
+	return static_cast<feed_server*>(p_this)->epoll_thread();
+}
+
+void *feed_server::epoll_thread()
+{
+	struct epoll_event events[FEED_SERVER_EVENTS];
+	uint8_t *buf = (uint8_t*)malloc(FEED_SERVER_RXBUF);
+	int listen_fd = listener.get_socket();
+
+	dprintf("(%d)", listen_fd);
+
+	while ((buf) && (!f_kill_thread)) {
+		int n = epoll_wait(epoll_fd, events, FEED_SERVER_EVENTS, 100);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait() failed");
+			break;
+		}
+		resume_conns();
+		for (int i = 0; i < n; i++) {
+			if (events[i].data.fd == listen_fd)
+				accept_conns();
+			else
+				read_conn(events[i].data.fd, events[i].events, buf, FEED_SERVER_RXBUF);
+		}
+	}
+
+	while (!conns.empty())
+		close_conn(conns.begin()->first);
+
+	close(epoll_fd);
+	epoll_fd = -1;
+
+	free(buf);
+	pthread_exit(NULL);
+}
+
+void feed_server::accept_conns()
+{
+	struct sockaddr_in tcpsa;
+	socklen_t salen;
+	struct epoll_event ev;
+
+	while (1) {
+		salen = sizeof(tcpsa);
+		int sock = accept4(listener.get_socket(), (struct sockaddr*)&tcpsa, &salen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (sock < 0) {
+			if ((errno != EAGAIN) && (errno != EINTR))
+				perror("accept4() failed");
+			return;
+		}
+		dprintf("(%d)", sock);
+
+		pthread_mutex_lock(&mutex);
+
+		feed &f = feeders[sock];
+		f.set_buffer_size(buffer_size);
+		/* a new connection on a reused socket number starts afresh */
+		f.parser.reset();
+
+		if (0 != f.attach_socket(sock)) {
+			pthread_mutex_unlock(&mutex);
+			close(sock);
+			continue;
+		}
+
+		feed_conn_stats_t &c = conns[sock];
+		memset(&c, 0, sizeof(c));
+		snprintf(c.peer, sizeof(c.peer), "%s:%d", inet_ntoa(tcpsa.sin_addr), ntohs(tcpsa.sin_port));
+		c.connected = c.last_rx = time(NULL);
+
+		pthread_mutex_unlock(&mutex);
+
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN | EPOLLRDHUP;
+		ev.data.fd = sock;
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sock, &ev) < 0) {
+			perror("epoll_ctl() failed");
+			close_conn(sock);
+			continue;
+		}
+
+		fprintf(stderr, "%s: %s connected\n", __func__, c.peer);
+
+		if (m_iface) m_iface->add_feeder(&f);
+	}
+}
+
+void feed_server::read_conn(int sock, unsigned int events, uint8_t *buf, int size)
+{
+	feed_map::iterator iter = feeders.find(sock);
+	if (iter == feeders.end())
+		return;
+
+	feed &f = iter->second;
+	int total = 0;
+	int reads = 0;
+	int ret = 0;
+
+	while (reads < FEED_SERVER_READS) {
+		ret = f.read_socket(buf, size);
+		if (ret <= 0)
+			break;
+		total += ret;
+		reads++;
+	}
+
+	if (reads) {
+		pthread_mutex_lock(&mutex);
+		feed_conn_stats_t &c = conns[sock];
+		c.bytes += total;
+		c.reads += reads;
+		c.last_rx = time(NULL);
+		pthread_mutex_unlock(&mutex);
+	}
+
+	if ((ret == 0) && (f.is_backlogged())) {
+		/* stop polling until the parser has caught up, whatever is
+		 * still pending (even a hangup) waits in the socket */
+		struct epoll_event ev;
+
+		memset(&ev, 0, sizeof(ev));
+		ev.data.fd = sock;
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, sock, &ev) == 0) {
+			backlogged.insert(sock);
+			return;
+		}
+		perror("epoll_ctl() failed");
+		ret = -1;
+	}
+
+	if ((ret < 0) || ((ret == 0) && (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))))
+		close_conn(sock);
+}
+
+void feed_server::resume_conns()
+{
+	std::set<int>::iterator iter = backlogged.begin();
+
+	while (iter != backlogged.end()) {
+		int sock = *iter;
+		feed_map::iterator f = feeders.find(sock);
+
+		if ((f != feeders.end()) && (f->second.is_backlogged())) {
+			++iter;
+			continue;
+		}
+		backlogged.erase(iter++);
+
+		struct epoll_event ev;
+
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN | EPOLLRDHUP;
+		ev.data.fd = sock;
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, sock, &ev) < 0) {
+			perror("epoll_ctl() failed");
+			close_conn(sock);
+		}
+	}
+}
+
+void feed_server::close_conn(int sock)
+{
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, sock, NULL);
+	backlogged.erase(sock);
+
+	pthread_mutex_lock(&mutex);
+
+	feed_conn_stats_map::iterator iter = conns.find(sock);
+	if (iter != conns.end()) {
+		fprintf(stderr, "%s: %s closed after %" PRIu64 " bytes in %lu reads\n",
+			__func__, iter->second.peer, iter->second.bytes, iter->second.reads);
+		conns.erase(iter);
+	}
+	/* the feed itself stays, its owner may still refer to it */
+	feeders[sock].detach_socket();
+
+	pthread_mutex_unlock(&mutex);
+}
+#else
+int feed_server::start_epoll(uint16_t)
+{
+	return -1;
+}
+#endif /* USE_EPOLL */
+
 int feed_server::start_udp_listener(uint16_t port_requested, feed_server_iface *iface)
 {
 	int ret = feeders[0].start_udp_listener(port_requested);
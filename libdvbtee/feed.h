@@ -22,10 +22,14 @@
 #ifndef __FEED_H__
 #define __FEED_H__
 
+#include <set>
 #include <pthread.h>
+#include <time.h>
 #include <unistd.h>
 #include "parse.h"
 #include "rbuf.h"
+#include "tssync.h"
+#include "uring.h"
 
 class feed_pull_iface
 {
@@ -35,6 +39,15 @@ public:
 
 void libdvbtee_set_debug_level(unsigned int debug);
 
+/* about a quarter of a second of a 38 Mbit/s mux, for set_buffer_size() */
+#define FEED_BUFFER_SIZE (188*7*1024)
+
+/* requested socket receive buffer for udp input */
+#define FEED_UDP_RCVBUF (4*1024*1024)
+
+/* read size for file input that can not be mapped, such as pipes */
+#define FEED_READ_SIZE (188*1024)
+
 class feed : public socket_listen_iface
 {
 public:
@@ -47,16 +60,61 @@ public:
 	int open_file(char* new_file, int flags = 0) { set_filename(new_file); return _open_file(flags); }
 	int open_file(int new_fd) { fd = new_fd; return fd; } /* assumes already open */
 
+	/* regular files are mapped and parsed straight from the page cache
+	 * unless this is turned off, anything else is read in read_size chunks */
+	void set_mmap(bool enable) { f_mmap = enable; }
+	void set_read_size(int size) { read_size = (size >= 188) ? size : 188; }
+
 	void stop_without_wait() { f_kill_thread = true; }
 	void stop();
 	int start();
+	/* parse the file from open_file() to its end on the calling thread,
+	 * as fast as it can be read, then close it.  stop_without_wait()
+	 * from another thread cuts it short */
+	int parse_file();
 	int start_stdin();
 	int start_socket(char* source);
 	int start_tcp_listener(uint16_t);
-	int start_udp_listener(uint16_t);
-
-	/* initialize for feed via functional interface */
+	/* a multicast group is joined rather than listening on every
+	 * address, restricted to a single source if one is given */
+	int start_udp_listener(uint16_t, const char *group = NULL, const char *source = NULL);
+
+	/* interface to join multicast groups on, by name, NULL for the default */
+	void set_udp_interface(const char *ifname);
+	/* SO_RCVBUF for the next start_udp_listener(), 0 for the system default */
+	void set_udp_rcvbuf(int size) { udp_rcvbuf = size; }
+	/* datagrams dropped by the kernel for lack of socket buffer space */
+	unsigned int get_kernel_drops() { return kernel_drops; }
+
+	/* decouple the reader threads from the parser by way of a ring of
+	 * the given size, parsed on a thread of its own.  0 (the default)
+	 * parses inline on the reader thread.  takes effect on the next start */
+	void set_buffer_size(int size) { buffer_size = size; }
+	int  get_buffer_size() { return buffer_size; }
+
+	/* play files back in real time by their PCR, speed times as fast.
+	 * 0 (the default) reads them as fast as possible.  takes effect
+	 * on the next start() */
+	void set_pacing(double speed) { pace_speed = (speed > 0) ? speed : 0; }
+	/* start over at the end of a file, rather than stopping */
+	void set_loop(bool enable) { f_loop = enable; }
+
+	/* 188, 192 (m2ts) or 204 byte packets, 0 (the default) to detect
+	 * the size from the start of the stream.  anything but 188 bytes
+	 * is cut down to 188 bytes before it reaches the parser */
+	void set_packet_size(int size) { normalizer.set_packet_size(size); }
+	int  get_packet_size() { return normalizer.get_packet_size(); }
+	/* the arrival timestamp of the last m2ts packet parsed, 27 MHz */
+	uint32_t get_arrival_time() { return normalizer.get_arrival_time(); }
+
+	/* file, tcp and udp input is served by the engine rather than a
+	 * thread of our own, wherever the engine supports it */
+	void set_engine(uring_engine *engine) { m_engine = engine; }
+
+	/* initialize for feed via functional interface.  prio is the nice
+	 * value of the parser thread, if set_buffer_size() enabled one */
 	int setup_feed(int prio);
+	/* any number of bytes, packets may be split across calls */
 	int push(int, const uint8_t*);
 	int pull(feed_pull_iface *iface);
 
@@ -64,6 +122,7 @@ public:
 
 	char* get_filename() { return filename; }
 	bool check();
+	void get_stats(rbuf_stats_t*);
 
 	parse parser;
 
@@ -80,6 +139,17 @@ public:
 	void add_tcp_feed(int);
 
 	void accept_socket(int sock) { add_tcp_feed(sock); }
+
+	/* take over a connected tcp socket that is read by the caller's
+	 * event loop through read_socket() rather than a thread of our own */
+	int attach_socket(int);
+	/* returns the number of bytes handed on, 0 if none are pending
+	 * or < 0 once the connection has gone away.  while the ring is
+	 * full nothing is read, tcp flow control holds the sender back */
+	int read_socket(uint8_t *buf, int size);
+	/* the ring has no room for a packet, read_socket() would not read */
+	bool is_backlogged();
+	void detach_socket();
 private:
 	pthread_t h_thread;
 	pthread_t h_feed_thread;
@@ -87,36 +157,62 @@ private:
 
 	char filename[256];
 	int fd;
-#if FEED_BUFFER
+
+	int buffer_size;
 	int feed_thread_prio;
+	bool f_buffered;
+
+	bool f_mmap;
+	int read_size;
+
+	int udp_rcvbuf;
+	unsigned int kernel_drops;
+	char udp_iface[16];
 
 	rbuf ringbuffer;
 
+	ts_normalizer normalizer;
+	int parse_data(int, const uint8_t*);
+
+	double pace_speed;
+	bool f_paced;
+	bool f_loop;
+	int pace_phase;
+	uint16_t pace_pid;
+	uint64_t pace_pcr;
+	uint64_t pace_last_pcr;
+	struct timespec pace_start;
+	int pace_data(int, const uint8_t*);
+
 	void            *feed_thread();
-#endif
 	void       *file_feed_thread();
-	void      *stdin_feed_thread();
 	void *tcp_client_feed_thread();
 	void *udp_listen_feed_thread();
 	void            *pull_thread();
-#if FEED_BUFFER
 	static void            *feed_thread(void*);
-#endif
 	static void       *file_feed_thread(void*);
-	static void      *stdin_feed_thread(void*);
 	static void *tcp_client_feed_thread(void*);
 	static void *udp_listen_feed_thread(void*);
 	static void            *pull_thread(void*);
 
 	void set_filename(char*);
 	int  _open_file(int flags);
-#if FEED_BUFFER
-	int start_feed();
-#endif
+	bool map_file();
+	void read_file();
+
+	int  start_feed();
+	void stop_feed();
+
+	/* where the reader threads should receive the next size bytes, and
+	 * hand them on.  lossy readers never wait for the parser thread */
+	int  get_write_ptr(void**, uint8_t*, int, bool lossy);
+	void put_write_ptr(void*, uint8_t*, int);
 
 	socket_listen listener;
 
 	feed_pull_iface *m_pull_iface;
+
+	uring_engine *m_engine;
 };
 
 typedef std::map<int, feed> feed_map;
@@ -129,14 +225,43 @@ public:
 };
 
 
+/* per connection counters of a feed_server */
+typedef struct
+{
+	char peer[INET_ADDRSTRLEN + 6];	/* address:port */
+	time_t connected;
+	time_t last_rx;
+	uint64_t bytes;
+	unsigned long int reads;
+	uint64_t bytes_dropped;		/* by the feed's ring, if buffered */
+} feed_conn_stats_t;
+
+typedef std::map<int, feed_conn_stats_t> feed_conn_stats_map;
+
+/* backlog of the tcp listener, when served by the event loop */
+#define FEED_SERVER_BACKLOG 64
+
+/* tcp connections are served by a single epoll loop where available,
+ * each one feeding a parser of its own.  otherwise every connection
+ * gets a feed with a reader thread of its own */
 class feed_server : public socket_listen_iface
 {
 public:
 	feed_server();
 	~feed_server();
 
+	feed_server(const feed_server&);
+	feed_server& operator= (const feed_server&);
+
 	int start_tcp_listener(uint16_t port_requested, feed_server_iface *iface = NULL);
 	int start_udp_listener(uint16_t port_requested, feed_server_iface *iface = NULL);
+	void stop();
+
+	/* applies to the feeds of connections accepted from now on */
+	void set_buffer_size(int size) { buffer_size = size; }
+
+	/* snapshot of the currently open connections, keyed by socket */
+	void get_conn_stats(feed_conn_stats_map&);
 
 	void accept_socket(int sock) { add_tcp_feed(sock); }
 private:
@@ -145,6 +270,28 @@ private:
 
 	feed_server_iface *m_iface;
 
+	int buffer_size;
+
+	pthread_t h_thread;
+	bool f_kill_thread;
+	int epoll_fd;
+
+	/* guards feeders and conns against get_conn_stats() */
+	pthread_mutex_t mutex;
+	feed_conn_stats_map conns;
+
+	/* connections left out of the event loop while their ring is full */
+	std::set<int> backlogged;
+
+	void *epoll_thread();
+	static void *epoll_thread(void*);
+
+	int  start_epoll(uint16_t port_requested);
+	void accept_conns();
+	void read_conn(int sock, unsigned int events, uint8_t *buf, int size);
+	void close_conn(int sock);
+	void resume_conns();
+
 	void add_tcp_feed(int);
 };
 
@@ -106,12 +106,10 @@ time_t datetime_utc(uint64_t time)
 //-----------------------------------------------------------------------------
 static inline void secs_to_tm(uint32_t seconds, struct tm *tm_time)
 {
-	struct tm *temp_time;
 	time_t secs;
 
 	secs = seconds + dvbpsi_atsc_unix_epoch_offset - GPStoUTCSecondsOffset;
-	temp_time = gmtime(&secs);
-	*tm_time = *temp_time;
+	gmtime_r(&secs, tm_time);
 }
 
 time_t atsc_datetime_utc(uint32_t in_time)
@@ -63,7 +63,7 @@ hlsfeed::hlsfeed(const char *url, curlhttpget_iface *iface)
 {
   int ret;
 #if PUSH_THREAD
-  push_buffer.set_capacity(HLS_BUFSIZE);
+  push_buffer.set_capacity(HLS_BUFSIZE, RBUF_MIRRORED);
   push_buffer.reset();
   ret = pthread_create(&h_push_thread, NULL, push_thread, this);
   if (0 != ret) {
@@ -167,16 +167,30 @@ void* hlsfeed::push_thread()
 	/* push data from hlsfeed buffer */
 	while (!f_kill_thread) {
 
-		buf_size = push_buffer.get_size();
-		if (!buf_size) {
-			usleep(200);
+		/* only whole packets are handed on */
+		if (!push_buffer.wait_for_size(188, 100))
 			continue;
-		}
+
+		buf_size = push_buffer.get_size();
 
 		buf_size = push_buffer.get_read_ptr((void**)&data, buf_size);
 		buf_size /= 188;
 		buf_size *= 188;
 
+		if (!buf_size) {
+			uint8_t pkt[188];
+
+			push_buffer.put_read_ptr(0);
+			/* less than a packet so far, leave it for the next write */
+			if (push_buffer.get_size() < 188)
+				continue;
+			/* a packet straddles the end of the ring, only
+			 * possible if the mirror mapping was unavailable */
+			if ((188 == push_buffer.read(pkt, 188)) && (m_iface))
+				m_iface->write_data(pkt, 188, 1);
+			continue;
+		}
+
 		if (m_iface) m_iface->write_data(data, 188, buf_size / 188);
 
 		push_buffer.put_read_ptr(buf_size);
@@ -192,11 +206,10 @@ void* hlsfeed::walk_thread()
 	/* push data from hlsfeed buffer */
 	while (!f_kill_thread) {
 
-		buf_size = walk_buffer.get_size();
-		if (!buf_size) {
-			usleep(200);
+		if (!walk_buffer.wait_for_size(1, 100))
 			continue;
-		}
+
+		buf_size = walk_buffer.get_size();
 
 		buf_size = walk_buffer.get_read_ptr((void**)&data, buf_size);
 
@@ -216,6 +229,7 @@ void hlsfeed::push(uint8_t *buffer, size_t size, size_t nmemb)
 	buffer += size;
 	nmemb--;
       } else {
+	push_buffer.count_dropped(size * nmemb);
 	fprintf(stderr, "%s: FAILED: %zu packets dropped\n", __func__, nmemb);
 	return;
       }
@@ -236,6 +250,7 @@ void hlsfeed::walk(uint8_t *buffer, size_t size, size_t nmemb)
 	buffer += size;
 	nmemb--;
       } else {
+	walk_buffer.count_dropped(size * nmemb);
 	fprintf(stderr, "%s: FAILED: %zu bytes dropped\n", __func__, size * nmemb);
 	return;
       }
@@ -27,7 +27,12 @@ SOURCES += channels.cpp \
     hdhr_tuner.cpp \
     atsctext.cpp \
     hlsfeed.cpp \
-    curlhttpget.cpp
+    curlhttpget.cpp \
+    tssync.cpp \
+    secfilter.cpp \
+    splitter.cpp \
+    uring.cpp \
+    batch.cpp
 
 HEADERS += atsctext.h \
     channels.h \
@@ -45,7 +50,13 @@ HEADERS += atsctext.h \
     tune.h \
     hdhr_tuner.h \
     hlsfeed.h \
-    curlhttpget.h
+    curlhttpget.h \
+    tssync.h \
+    secfilter.h \
+    snapshot.h \
+    splitter.h \
+    uring.h \
+    batch.h
 
 symbian {
     MMP_RULES += EXPORTUNFROZEN
@@ -103,6 +114,8 @@ QMAKE_CXXFLAGS += -DUSE_HDHOMERUN
 
 unix:!macx:!symbian {
     QMAKE_CXXFLAGS += -DUSE_LINUXTV
+    QMAKE_CXXFLAGS += -DUSE_IO_URING
+    QMAKE_CXXFLAGS += -DUSE_EPOLL
 }
 
 OTHER_FILES += Makefile.am
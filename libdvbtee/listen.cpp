@@ -93,6 +93,10 @@ void socket_listen::stop()
 
 	stop_without_wait();
 
+	/* opened by open_socket(), there is no thread to close it */
+	if (!h_thread)
+		close_socket();
+
 	while (-1 != sock_fd) {
 		usleep(20*1000);
 	}
@@ -100,6 +104,20 @@ void socket_listen::stop()
 }
 
 int socket_listen::start(uint16_t port_requested)
+{
+	int ret = open_socket(port_requested);
+	if (ret < 0)
+		return ret;
+
+	ret = pthread_create(&h_thread, NULL, listen_thread, this);
+
+	if (0 != ret)
+		perror("pthread_create() failed");
+
+	return ret;
+}
+
+int socket_listen::open_socket(uint16_t port_requested, int backlog)
 {
 	struct sockaddr_in tcp_sock;
 
@@ -136,15 +154,12 @@ int socket_listen::start(uint16_t port_requested)
 		perror("set non-blocking failed");
 		return -1;
 	}
-#define MAX_SOCKETS 4
-	listen(sock_fd, MAX_SOCKETS);
-
-	int ret = pthread_create(&h_thread, NULL, listen_thread, this);
-
-	if (0 != ret)
-		perror("pthread_create() failed");
+	if (listen(sock_fd, backlog) < 0) {
+		perror("listen failed");
+		return -1;
+	}
 
-	return ret;
+	return 0;
 }
 
 int socket_listen::start_udp(uint16_t port_requested)
@@ -50,6 +50,10 @@ public:
 	void set_interface(socket_listen_iface *iface) { m_socket_listen_iface = iface; }
 
 	int start(uint16_t port_requested);
+	/* bind and listen without an accept thread, for callers that
+	 * poll get_socket() and accept() connections themselves */
+	int open_socket(uint16_t port_requested, int backlog = 4);
+	int get_socket() { return sock_fd; }
 	int start_udp(uint16_t port_requested);
 	void stop();
 
@@ -25,10 +25,12 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <algorithm>
 #include <string>
 #include <netdb.h>
 
 #include "output.h"
+#include "secfilter.h"
 #include "log.h"
 #define CLASS_MODULE "out"
 
@@ -41,6 +43,7 @@
 
 #define dprintf(fmt, arg...) __dprintf(DBG_OUTPUT, fmt, ##arg)
 
+#define BROADCAST_RING 1
 #define DOUBLE_BUFFER 0
 #define PREVENT_RBUF_DEADLOCK 0
 #define NON_BLOCKING_TCP_SEND 1
@@ -219,17 +222,21 @@ output_stream::output_stream()
   , sock(-1)
   , mimetype(MIMETYPE_OCTET_STREAM)
   , ringbuffer()
+  , broadcast(NULL)
+  , broadcast_pos(0)
+  , overruns(0)
   , stream_method(OUTPUT_STREAM_UDP)
   , count_in(0)
   , count_out(0)
   , m_iface(NULL)
   , stream_cb(NULL)
   , stream_cb_priv(NULL)
-  , have_pat(false)
+  , pat_cc(0)
 {
 	dprintf("()");
 	memset(&name, 0, sizeof(name));
 	memset(&ip_addr, 0, sizeof(ip_addr));
+	memset(&broadcast_stats, 0, sizeof(broadcast_stats));
 	pids.clear();
 }
 
@@ -249,6 +256,10 @@ output_stream::output_stream(const output_stream&)
 	h_thread = (pthread_t)NULL;
 	f_kill_thread = false;
 	f_streaming = false;
+	broadcast = NULL;
+	broadcast_pos = 0;
+	overruns = 0;
+	memset(&broadcast_stats, 0, sizeof(broadcast_stats));
 	m_iface = NULL;
 	stream_cb = NULL;
 	stream_cb_priv = NULL;
@@ -260,7 +271,7 @@ output_stream::output_stream(const output_stream&)
 	memset(&name, 0, sizeof(name));
 	memset(&ip_addr, 0, sizeof(ip_addr));
 	pids.clear();
-	have_pat = false;
+	pat_cc = 0;
 }
 
 output_stream& output_stream::operator= (const output_stream& cSource)
@@ -273,6 +284,10 @@ output_stream& output_stream::operator= (const output_stream& cSource)
 	h_thread = (pthread_t)NULL;
 	f_kill_thread = false;
 	f_streaming = false;
+	broadcast = NULL;
+	broadcast_pos = 0;
+	overruns = 0;
+	memset(&broadcast_stats, 0, sizeof(broadcast_stats));
 	stream_cb = NULL;
 	stream_cb_priv = NULL;
 	count_in = 0;
@@ -283,7 +298,8 @@ output_stream& output_stream::operator= (const output_stream& cSource)
 	memset(&name, 0, sizeof(name));
 	memset(&ip_addr, 0, sizeof(ip_addr));
 	pids.clear();
-	have_pat = false;
+	filter_state = cSource.filter_state;
+	pat_cc = 0;
 
 	return *this;
 }
@@ -299,7 +315,7 @@ void* output_stream::output_stream_thread(void *p_this)
 void* output_stream::output_stream_thread()
 {
 	uint8_t *data = NULL;
-	int buf_size, ret = 0;
+	int buf_size, sent, ret = 0;
 
 	dprintf("(%d)", sock);
 #if 1
@@ -315,21 +331,76 @@ void* output_stream::output_stream_thread()
 	}
 
 #endif
+	if (broadcast)
+		broadcast_pos = broadcast->get_write_pos();
+
 	f_streaming = true;
 
 	/* push data from output_stream buffer to target */
 	while (!f_kill_thread) {
 
-		buf_size = ringbuffer.get_size();
-		if (buf_size < OUTPUT_STREAM_PACKET_SIZE) {
-			usleep(1000);
+		if (broadcast) {
+			if (!broadcast->wait_for_size(broadcast_pos, OUTPUT_STREAM_PACKET_SIZE, 100, &broadcast_stats))
+				continue;
+
+			buf_size = broadcast->get_size(broadcast_pos);
+			rbuf_stats_peak(&broadcast_stats.peak_fill, buf_size);
+
+			buf_size = broadcast->get_read_ptr(broadcast_pos, (void**)&data, OUTPUT_STREAM_PACKET_SIZE);
+			sent = 0;
+			if (buf_size > 0) {
+				buf_size /= 188;
+				buf_size *= 188;
+				unsigned int idx;
+				const output_filter *f = filter_state.read_lock(&idx);
+
+				/* take our own copy, the writer may lap us while
+				 * a slow client holds up the send */
+				if (f->filtered)
+					sent = filter(f, data, buf_size, filter_buf);
+				else {
+					memcpy(filter_buf, data, buf_size);
+					sent = buf_size;
+				}
+				filter_state.read_unlock(idx);
+			}
+			if ((buf_size < 0) || (!broadcast->is_valid(broadcast_pos))) {
+				/* the writer lapped us, the copy may be torn.
+				 * skip ahead to live data */
+				overruns++;
+				uint64_t resync_pos = broadcast->get_write_pos();
+				__atomic_fetch_add(&broadcast_stats.bytes_dropped, resync_pos - broadcast_pos, __ATOMIC_RELAXED);
+				broadcast_pos = resync_pos;
+				dprintf("(%d: %s) overrun #%lu", sock, name, overruns);
+				continue;
+			}
+			if (sent)
+				stream(filter_buf, sent);
+			broadcast_pos += buf_size;
+			count_in  += buf_size;
+			count_out += sent;
 			continue;
 		}
 
+		if (!ringbuffer.wait_for_size(OUTPUT_STREAM_PACKET_SIZE, 100))
+			continue;
+
 		buf_size = ringbuffer.get_read_ptr((void**)&data, OUTPUT_STREAM_PACKET_SIZE);
 		buf_size /= 188;
 		buf_size *= 188;
 
+		if (!buf_size) {
+			/* a packet straddles the end of the ring, only
+			 * possible if the mirror mapping was unavailable */
+			uint8_t pkt[188];
+
+			ringbuffer.put_read_ptr(0);
+			buf_size = ringbuffer.read(pkt, 188);
+			stream(pkt, buf_size);
+			count_out += buf_size;
+			continue;
+		}
+
 #if PREVENT_RBUF_DEADLOCK
 		{
 			uint8_t newdata[buf_size];
@@ -378,7 +449,8 @@ int output_stream::start()
 
 	dprintf("(%d)", sock);
 
-	ringbuffer.set_capacity(OUTPUT_STREAM_BUF_SIZE);
+	if (!broadcast)
+		ringbuffer.set_capacity(OUTPUT_STREAM_BUF_SIZE, RBUF_MIRRORED);
 
 	int ret = pthread_create(&h_thread, NULL, output_stream_thread, this);
 	if (0 != ret)
@@ -420,7 +492,7 @@ bool output_stream::check()
 	if (!ret)
 		dprintf("(%d: %s) not streaming!", sock, name);
 	else {
-		dprintf("(%d: %s) %s %lu in, %lu out",
+		dprintf("(%d: %s) %s %lu in, %lu out, %lu overruns",
 			sock, name,
 			(stream_method == OUTPUT_STREAM_UDP) ? "UDP" :
 			(stream_method == OUTPUT_STREAM_TCP) ? "TCP" :
@@ -429,7 +501,7 @@ bool output_stream::check()
 			(stream_method == OUTPUT_STREAM_FUNC) ? "FUNC" :
 			(stream_method == OUTPUT_STREAM_INTF) ? "INTF" :
 			(stream_method == OUTPUT_STREAM_STDOUT) ? "STDOUT" : "UNKNOWN",
-			count_in / 188, count_out / 188);
+			count_in / 188, count_out / 188, overruns);
 #if 1//DBG
 		if (pids.size()) {
 			dprintf("(%d: %s) subscribed to the following pids:", sock, name);
@@ -444,24 +516,76 @@ bool output_stream::check()
 	return ret;
 }
 
+void output_stream::get_stats(rbuf_stats_t *s)
+{
+	if (!broadcast) {
+		ringbuffer.get_stats(s);
+		return;
+	}
+
+	rbuf_stats_load(s, &broadcast_stats);
+	s->bytes_in  = count_in;
+	s->bytes_out = count_out;
+	s->capacity  = broadcast->get_capacity();
+	s->fill      = (f_streaming) ? broadcast->get_size(broadcast_pos) : 0;
+	if (s->fill < 0)
+		s->fill = s->capacity;
+}
+
+const uint8_t *output_stream::filter_pkt(const output_filter *f, const uint8_t *p)
+{
+	uint16_t pid = ((p[1] & 0x1f) << 8) | p[2];
+
+	if (pid == 0) {
+		if (!f->have_pat)
+			return p;
+		memcpy(pat_pkt, f->pat_pkt, 188);
+		pat_pkt[3] = 0x10 | (pat_cc++ & 0x0f);
+		return pat_pkt;
+	}
+	return (f->want_pid(pid)) ? p : NULL;
+}
+
+int output_stream::filter(const output_filter *f, const uint8_t *p, int size, uint8_t *out)
+{
+	int len = 0;
+
+	for (; size >= 188; p += 188, size -= 188) {
+		const uint8_t *q = filter_pkt(f, p);
+		if (q) {
+			memcpy(&out[len], q, 188);
+			len += 188;
+		}
+	}
+	return len;
+}
+
 bool output_stream::push(uint8_t* p_data, int size)
 {
-#if TUNER_RESOURCE_SHARING
-	if ((0 == (((p_data[1] & 0x1f) << 8) | p_data[2])) && (188 == size)) {
-		if (!have_pat) {
-			memcpy(pat_pkt, p_data, 188);
-			have_pat = true;
+	unsigned int idx;
+	const output_filter *f = filter_state.read_lock(&idx);
+
+	if (f->filtered) {
+		int dropped = 0;
+
+		for (; size >= 188; p_data += 188, size -= 188) {
+			const uint8_t *p = filter_pkt(f, p_data);
+			if (!p)
+				continue;
+			if (ringbuffer.write(p, 188))
+				count_in += 188;
+			else
+				dropped += 188;
 		}
-		if (ringbuffer.write(pat_pkt, 188)) {
-			count_in += 188;
-			return true;
-		} else {
-			fprintf(stderr, "%s> FAILED: PAT Table (%d bytes) dropped\n", __func__, 188);
+		filter_state.read_unlock(idx);
+		if (dropped) {
+			ringbuffer.count_dropped(dropped);
+			fprintf(stderr, "%s> FAILED: %d bytes dropped\n", __func__, dropped);
 		}
-	} else if (want_pkt(p_data)) {
-#else
-	if ((0 == (((p_data[1] & 0x1f) << 8) | p_data[2])) || (want_pkt(p_data))) {
-#endif
+		return (dropped == 0);
+	}
+	filter_state.read_unlock(idx);
+
 	/* push data into output_stream buffer */
 	if (!ringbuffer.write(p_data, size))
 		while (size >= 188)
@@ -470,6 +594,7 @@ bool output_stream::push(uint8_t* p_data, int size)
 				size -= 188;
 				count_in += 188;
 			} else {
+				ringbuffer.count_dropped(size);
 				fprintf(stderr, "%s> FAILED: %d bytes dropped\n", __func__, size);
 #if 0
 				dprintf("(push-false-stream) %d packets in, %d packets out, %d packets remain in rbuf", count_in / 188, count_out / 188, ringbuffer.get_size() / 188);
@@ -480,7 +605,6 @@ bool output_stream::push(uint8_t* p_data, int size)
 #if 0
 	dprintf("(push-true-stream) %d packets in, %d packets out, %d packets remain in rbuf", count_in / 188, count_out / 188, ringbuffer.get_size() / 188);
 #endif
-	}
 	return true;
 }
 
@@ -698,15 +822,100 @@ int output_stream::add(char* target, map_pidtype &pids)
 
 int output_stream::set_pids(map_pidtype &new_pids)
 {
-	for (map_pidtype::const_iterator iter = new_pids.begin(); iter != new_pids.end(); ++iter)
+	filter_state.lock();
+	output_filter *f = new output_filter(*filter_state.get());
+
+	for (map_pidtype::const_iterator iter = new_pids.begin(); iter != new_pids.end(); ++iter) {
 		pids[iter->first] = iter->second;
+		f->pid_map[(iter->first & 0x1fff) >> 5] |= 1U << (iter->first & 31);
+	}
+	f->filtered = (pids.size() > 0);
+
+	filter_state.publish(f);
+	filter_state.unlock();
 	return 0;
 }
 
+void output_stream::reset_pids()
+{
+	filter_state.lock();
+	pids.clear();
+	filter_state.publish(new output_filter);
+	filter_state.unlock();
+}
+
+void output_stream::set_programs(uint16_t ts_id, uint8_t version, const map_pidtype &pat_programs)
+{
+	filter_state.lock();
+	const output_filter *cur = filter_state.get();
+	map_pidtype programs;
+
+	/* the programs whose PMT we carry */
+	for (map_pidtype::const_iterator iter = pat_programs.begin(); iter != pat_programs.end(); ++iter)
+		if ((iter->first) && (pids.count(iter->second)))
+			programs[iter->first] = iter->second;
+
+	/* a single packet holds up to 42 programs */
+	if ((!programs.size()) || (programs.size() > (188 - 5 - 12) / 4)) {
+		if (cur->have_pat) {
+			output_filter *f = new output_filter(*cur);
+			f->have_pat = false;
+			filter_state.publish(f);
+		}
+		filter_state.unlock();
+		return;
+	}
+
+	output_filter *f = new output_filter(*cur);
+	uint8_t *s = &f->pat_pkt[5];
+	int len = 8;
+
+	memset(f->pat_pkt, 0xff, sizeof(f->pat_pkt));
+	f->pat_pkt[0] = 0x47;
+	f->pat_pkt[1] = 0x40;
+	f->pat_pkt[2] = 0x00;
+	f->pat_pkt[3] = 0x10;
+	f->pat_pkt[4] = 0x00; /* pointer field */
+
+	unsigned int section_length = 5 + 4 * programs.size() + 4;
+	s[0] = 0x00; /* table id */
+	s[1] = 0xb0 | ((section_length >> 8) & 0x0f);
+	s[2] = section_length & 0xff;
+	s[3] = ts_id >> 8;
+	s[4] = ts_id & 0xff;
+	s[5] = 0xc1 | ((version & 0x1f) << 1);
+	s[6] = 0x00; /* section number */
+	s[7] = 0x00; /* last section number */
+
+	for (map_pidtype::const_iterator iter = programs.begin(); iter != programs.end(); ++iter) {
+		s[len++] = iter->first >> 8;
+		s[len++] = iter->first & 0xff;
+		s[len++] = 0xe0 | ((iter->second >> 8) & 0x1f);
+		s[len++] = iter->second & 0xff;
+	}
+
+	uint32_t crc = section_crc32(s, len);
+	s[len++] = crc >> 24;
+	s[len++] = crc >> 16;
+	s[len++] = crc >> 8;
+	s[len++] = crc;
+
+	/* readers are only made to wait for a PAT that differs */
+	if ((cur->have_pat) && (0 == memcmp(cur->pat_pkt, f->pat_pkt, sizeof(f->pat_pkt))))
+		delete f;
+	else {
+		f->have_pat = true;
+		filter_state.publish(f);
+	}
+	filter_state.unlock();
+}
+
 int output_stream::get_pids(map_pidtype &result)
 {
+	filter_state.lock();
 	for (map_pidtype::const_iterator iter = pids.begin(); iter != pids.end(); ++iter)
 		result[iter->first] = iter->second;
+	filter_state.unlock();
 	return 0;
 }
 
@@ -773,6 +982,7 @@ output& output::operator= (const output& cSource)
 
 	memset(&ringbuffer, 0, sizeof(ringbuffer));
 
+	active = cSource.active;
 	output_streams.clear();
 
 	return *this;
@@ -797,37 +1007,49 @@ void* output::output_thread()
 	/* push data from main output buffer into output_stream buffers */
 	while (!f_kill_thread) {
 
-		buf_size = ringbuffer.get_size();
 		//data = NULL;
-		if (buf_size >= 188) {
+		if (ringbuffer.wait_for_size(188, 100)) {
+			buf_size = ringbuffer.get_size();
 #if !PREVENT_RBUF_DEADLOCK
 			buf_size = ringbuffer.get_read_ptr((void**)&data, buf_size);
 			buf_size /= 188;
 			buf_size *= 188;
+
+			if (!buf_size) {
+				/* a packet straddles the end of the ring, only
+				 * possible if the mirror mapping was unavailable */
+				uint8_t pkt[188];
+
+				unsigned int idx;
+				const output_stream_list *list = active.read_lock(&idx);
+
+				ringbuffer.put_read_ptr(0);
+				buf_size = ringbuffer.read(pkt, 188);
+				for (output_stream_list::const_iterator iter = list->begin(); iter != list->end(); ++iter)
+					if ((*iter)->is_streaming())
+						(*iter)->push(pkt, buf_size);
+				active.read_unlock(idx);
+				count_out += buf_size;
+				continue;
+			}
 #else
 			uint8_t data[buf_size];
 			buf_size = ringbuffer.read(data, buf_size);
 #endif
-			if (buf_size)
-			for (output_stream_map::iterator iter = output_streams.begin(); iter != output_streams.end(); ++iter) {
-				if (iter->second.is_streaming())
-					iter->second.push(data, buf_size);
-#if 0
-				else {
-					dprintf("erasing idle output stream...");
-					output_streams.erase(iter->first);
-					dprintf("garbage collection complete");
-				}
-#endif
+			if (buf_size) {
+				unsigned int idx;
+				const output_stream_list *list = active.read_lock(&idx);
+
+				for (output_stream_list::const_iterator iter = list->begin(); iter != list->end(); ++iter)
+					if ((*iter)->is_streaming())
+						(*iter)->push(data, buf_size);
+				active.read_unlock(idx);
 			}
 #if !PREVENT_RBUF_DEADLOCK
 			ringbuffer.put_read_ptr(buf_size);
 #endif
 			count_out += buf_size;
-		} else {
-			usleep(1000);
 		}
-
 	}
 	f_streaming = false;
 	pthread_exit(NULL);
@@ -851,8 +1073,10 @@ int output::add_http_server(int port)
 
 int output::get_pids(map_pidtype &result)
 {
+	active.lock();
 	for (output_stream_map::iterator iter = output_streams.begin(); iter != output_streams.end(); ++iter)
 		iter->second.get_pids(result);
+	active.unlock();
 	return 0;
 }
 
@@ -862,12 +1086,14 @@ bool output::check()
 	unsigned int dead = 0;
 	bool ret = false;
 
+	active.lock();
 	for (output_stream_map::iterator iter = output_streams.begin(); iter != output_streams.end(); ++iter) {
 		bool streaming = iter->second.check();
 		ret |= streaming;
 		if (!streaming)
 			dead++;
 	}
+	active.unlock();
 	if (dead) {
 		dprintf("%d dead streams found", dead);
 		reclaim_resources();
@@ -888,30 +1114,76 @@ bool output::check()
 	return ret;
 }
 
+void output::get_stats(rbuf_stats_t *s)
+{
+	ringbuffer.get_stats(s);
+
+	if (broadcast.get_capacity()) {
+		/* the broadcast ring never refuses a write, readers that
+		 * fall behind show up in their own output_stream stats */
+		s->capacity = broadcast.get_capacity();
+		s->bytes_in = s->bytes_out = count_in;
+	}
+}
+
+bool output::get_stats(int target_id, rbuf_stats_t *s)
+{
+	active.lock();
+	output_stream_map::iterator iter = output_streams.find(target_id);
+	bool found = (iter != output_streams.end());
+
+	if (found)
+		iter->second.get_stats(s);
+	active.unlock();
+
+	return found;
+}
+
 void output::reclaim_resources()
 {
 	dprintf("()");
-	bool erased = false;
+	std::vector<unsigned int> dead;
 
-	for (output_stream_map::iterator iter = output_streams.begin(); iter != output_streams.end(); ++iter) {
-		if (!iter->second.check()) {
+	active.lock();
+	for (output_stream_map::iterator iter = output_streams.begin(); iter != output_streams.end(); ++iter)
+		if (!iter->second.check())
+			dead.push_back(iter->first);
+
+	if (dead.size()) {
+		output_stream_list *list = new output_stream_list;
+
+		for (output_stream_map::iterator iter = output_streams.begin(); iter != output_streams.end(); ++iter)
+			if (std::find(dead.begin(), dead.end(), iter->first) == dead.end())
+				list->push_back(&iter->second);
+
+		/* nobody pushes to them once this returns */
+		active.publish(list);
+		active.synchronize();
+
+		for (std::vector<unsigned int>::const_iterator iter = dead.begin(); iter != dead.end(); ++iter) {
 			dprintf("erasing idle output stream...");
-			output_streams.erase(iter->first);
-			/* stop the loop if we erased any targets */
-			erased = true;
-			break;
+			output_streams.erase(*iter);
 		}
 	}
-	/* if we erased a target, restart the above by re-calling this function recursively */
-	if (erased)
-		reclaim_resources();
+	active.unlock();
 }
 
 int output::start()
 {
 	dprintf("()");
 
-#if DOUBLE_BUFFER
+	active.lock();
+#if BROADCAST_RING
+	if (broadcast.get_capacity() <= 0)
+		broadcast.set_capacity(OUTPUT_BROADCAST_BUF_SIZE);
+
+	for (output_stream_map::iterator iter = output_streams.begin(); iter != output_streams.end(); ++iter) {
+		iter->second.set_broadcast(&broadcast);
+		iter->second.start();
+	}
+	active.unlock();
+	return 0;
+#elif DOUBLE_BUFFER
 	int ret = 0;
 
 	if (output_streams.size() <= 1)
@@ -930,15 +1202,17 @@ int output::start()
 
 	/* allocates out buffer if and only if we have begun streaming output */
 	if (ringbuffer.get_capacity() <= 0)
-		ringbuffer.set_capacity(OUTPUT_STREAM_BUF_SIZE*2);
+		ringbuffer.set_capacity(OUTPUT_STREAM_BUF_SIZE*2, RBUF_MIRRORED);
 nobuffer:
 	for (output_stream_map::iterator iter = output_streams.begin(); iter != output_streams.end(); ++iter)
 		iter->second.start();
 fail:
+	active.unlock();
 	return ret;
 #else
 	for (output_stream_map::iterator iter = output_streams.begin(); iter != output_streams.end(); ++iter)
 		iter->second.start();
+	active.unlock();
 	return 0;
 #endif
 }
@@ -950,11 +1224,13 @@ void output::stop()
 	stop_without_wait();
 
 	/* call stop_without_wait() on everybody first before we call stop() on everybody, which is a blocking function */
+	active.lock();
 	for (output_stream_map::iterator iter = output_streams.begin(); iter != output_streams.end(); ++iter)
 		iter->second.stop_without_wait();
 
 	for (output_stream_map::iterator iter = output_streams.begin(); iter != output_streams.end(); ++iter)
 		iter->second.stop();
+	active.unlock();
 
 	while (f_streaming)
 		usleep(20*1000);
@@ -966,10 +1242,12 @@ void output::stop(int id)
 {
 	dprintf("(%d)", id);
 
+	active.lock();
 	if (output_streams.count(id))
 		output_streams[id].stop();
 	else
 		dprintf("no such stream id: %d", id);
+	active.unlock();
 
 	return;
 }
@@ -978,22 +1256,26 @@ bool output::push(uint8_t* p_data, int size)
 {
 	bool ret = true;
 
-	if (ringbuffer.get_capacity()) {
+	if (broadcast.get_capacity()) {
+
+		/* written once, each output_stream reads it at its own pace */
+		broadcast.write(p_data, size);
+	} else if (ringbuffer.get_capacity()) {
 
 		/* push data into output buffer */
 		ret = ringbuffer.write(p_data, size);
-		if (!ret)
+		if (!ret) {
+			ringbuffer.count_dropped(size);
 			fprintf(stderr, "%s: FAILED: %d bytes dropped\n", __func__, size);
-	} else for (output_stream_map::iterator iter = output_streams.begin(); iter != output_streams.end(); ++iter) {
-		if (iter->second.is_streaming())
-			iter->second.push(p_data, size);
-#if 0
-		else {
-			dprintf("erasing idle output stream...");
-			output_streams.erase(iter->first);
-			dprintf("garbage collection complete");
 		}
-#endif
+	} else {
+		unsigned int idx;
+		const output_stream_list *list = active.read_lock(&idx);
+
+		for (output_stream_list::const_iterator iter = list->begin(); iter != list->end(); ++iter)
+			if ((*iter)->is_streaming())
+				(*iter)->push(p_data, size);
+		active.read_unlock(idx);
 	}
 	count_in += size;
 
@@ -1007,13 +1289,16 @@ bool output::push(uint8_t* p_data, enum output_options opt)
 
 int output::add_stdout(map_pidtype &pids)
 {
+	active.lock();
 	int target_id = num_targets;
 	/* push data into output buffer */
 	int ret = output_streams[target_id].add_stdout(pids);
-	if (ret == 0)
+	if (ret == 0) {
 		num_targets++;
-	else
+		publish_active();
+	} else
 		dprintf("failed to add target #%d", target_id);
+	active.unlock();
 
 	dprintf("~(%d->STDOUT)", target_id);
 
@@ -1024,18 +1309,22 @@ int output::add(void* priv, stream_callback callback, map_pidtype &pids)
 {
 	if ((callback) && (priv)) {
 
+		active.lock();
 		int search_id = search(priv, callback);
 		if (search_id >= 0) {
+			active.unlock();
 			dprintf("target callback already exists #%d", search_id);
 			return search_id;
 		}
 		int target_id = num_targets;
 		/* push data into output buffer */
 		int ret = output_streams[target_id].add(priv, callback, pids);
-		if (ret == 0)
+		if (ret == 0) {
 			num_targets++;
-		else
+			publish_active();
+		} else
 			dprintf("failed to add target #%d", target_id);
+		active.unlock();
 
 		dprintf("~(%d->FUNC)", target_id);
 
@@ -1048,18 +1337,22 @@ int output::add(output_stream_iface *iface, map_pidtype &pids)
 {
 	if (iface) {
 
+		active.lock();
 		int search_id = search(iface);
 		if (search_id >= 0) {
+			active.unlock();
 			dprintf("target interface already exists #%d", search_id);
 			return search_id;
 		}
 		int target_id = num_targets;
 		/* push data into output buffer */
 		int ret = output_streams[target_id].add(iface, pids);
-		if (ret == 0)
+		if (ret == 0) {
 			num_targets++;
-		else
+			publish_active();
+		} else
 			dprintf("failed to add target #%d", target_id);
+		active.unlock();
 
 		dprintf("~(%d->INTF)", target_id);
 
@@ -1072,18 +1365,22 @@ int output::add(int socket, unsigned int method, map_pidtype &pids)
 {
 	if (socket >= 0) {
 
+		active.lock();
 		int search_id = search(socket, method);
 		if (search_id >= 0) {
+			active.unlock();
 			dprintf("target socket already exists #%d", search_id);
 			return search_id;
 		}
 		int target_id = num_targets;
 		/* push data into output buffer */
 		int ret = output_streams[num_targets].add(socket, method, pids);
-		if (ret == 0)
+		if (ret == 0) {
 			num_targets++;
-		else
+			publish_active();
+		} else
 			dprintf("failed to add target #%d", target_id);
+		active.unlock();
 
 		dprintf("~(%d->SOCKET[%d])", target_id, socket);
 
@@ -1114,8 +1411,10 @@ int output::add(char* target, map_pidtype &pids)
 
 int output::__add(char* target, map_pidtype &pids)
 {
+	active.lock();
 	int search_id = search(target);
 	if (search_id >= 0) {
+		active.unlock();
 		dprintf("target already exists #%d: %s", search_id, target);
 		return search_id;
 	}
@@ -1125,10 +1424,12 @@ int output::__add(char* target, map_pidtype &pids)
 
 	/* push data into output buffer */
 	int ret = output_streams[target_id].add(target, pids);
-	if (ret == 0)
+	if (ret == 0) {
 		num_targets++;
-	else
+		publish_active();
+	} else
 		dprintf("failed to add target #%d: %s", target_id, target);
+	active.unlock();
 
 	dprintf("~(%d->%s)", target_id, target);
 
@@ -1137,11 +1438,35 @@ int output::__add(char* target, map_pidtype &pids)
 
 void output::reset_pids(int target_id)
 {
+	active.lock();
 	if (output_streams.count(target_id))
 		output_streams[target_id].reset_pids();
 	else if (-1 == target_id)
 		for (output_stream_map::iterator iter = output_streams.begin(); iter != output_streams.end(); ++iter)
 			iter->second.reset_pids();
+	active.unlock();
+}
+
+void output::set_programs(uint16_t ts_id, uint8_t version, const map_pidtype &programs)
+{
+	/* called by the feeding thread, which never waits for the control paths */
+	unsigned int idx;
+	const output_stream_list *list = active.read_lock(&idx);
+
+	for (output_stream_list::const_iterator iter = list->begin(); iter != list->end(); ++iter)
+		(*iter)->set_programs(ts_id, version, programs);
+	active.read_unlock(idx);
+}
+
+/* active.lock() held */
+void output::publish_active()
+{
+	output_stream_list *list = new output_stream_list;
+
+	for (output_stream_map::iterator iter = output_streams.begin(); iter != output_streams.end(); ++iter)
+		list->push_back(&iter->second);
+
+	active.publish(list);
 }
 
 int output::search(void* priv, stream_callback callback)
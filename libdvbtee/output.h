@@ -30,9 +30,11 @@
 
 #include <map>
 #include <string>
+#include <vector>
 
 #include "listen.h"
 #include "rbuf.h"
+#include "snapshot.h"
 
 #define TUNER_RESOURCE_SHARING 0
 
@@ -63,9 +65,25 @@ const std::string http_response(enum output_mimetype mimetype);
 #define OUTPUT_AV (OUTPUT_PATPMT | OUTPUT_PES)
 
 #define OUTPUT_STREAM_BUF_SIZE 188*7*198
+#define OUTPUT_BROADCAST_BUF_SIZE (OUTPUT_STREAM_BUF_SIZE*4)
 
 typedef int (*stream_callback)(void *, const uint8_t *, size_t);
 
+/* what an output_stream lets through, replaced as a whole */
+struct output_filter
+{
+	output_filter() : filtered(false), have_pat(false) { memset(pid_map, 0, sizeof(pid_map)); memset(pat_pkt, 0, sizeof(pat_pkt)); }
+
+	/* a bit per pid.  unless filtered, every packet passes */
+	uint32_t pid_map[0x2000 / 32];
+	bool filtered;
+
+	bool have_pat;
+	uint8_t pat_pkt[188];
+
+	bool want_pid(uint16_t pid) const { return ((!filtered) || (pid_map[pid >> 5] & (1U << (pid & 31)))) ? true : false; }
+};
+
 class output_stream_iface
 {
 public:
@@ -82,7 +100,10 @@ public:
 	output_stream& operator= (const output_stream&);
 #endif
 	bool is_streaming() { return ((!f_kill_thread) && (f_streaming)); }
-	void stop_without_wait() { f_kill_thread = true; }
+	void stop_without_wait() { f_kill_thread = true; ringbuffer.notify(); if (broadcast) broadcast->notify(); }
+
+	/* read from a shared ring rather than having data pushed into our own */
+	void set_broadcast(rbuf_broadcast *bcast) { if (!f_streaming) broadcast = bcast; }
 
 	int start();
 	bool drain();
@@ -99,9 +120,14 @@ public:
 	int add_stdout(map_pidtype &);
 
 	bool check();
+	void get_stats(rbuf_stats_t*);
 
 	int get_pids(map_pidtype&);
-	void reset_pids() { pids.clear(); }
+	void reset_pids();
+
+	/* program number -> PMT pid, as in the original PAT.  those whose
+	 * PMT this stream carries make up a PAT of our own in its place */
+	void set_programs(uint16_t ts_id, uint8_t version, const map_pidtype &programs);
 
 	bool verify(void* priv, stream_callback callback) { return ((priv == stream_cb_priv) && (callback == stream_cb)); }
 	bool verify(output_stream_iface *iface) { return (m_iface == iface); }
@@ -119,6 +145,12 @@ private:
 
 	rbuf ringbuffer;
 
+	rbuf_broadcast *broadcast;
+	uint64_t broadcast_pos;
+	unsigned long int overruns;
+	/* our view of the shared ring, bytes we were lapped by count as dropped */
+	rbuf_stats_t broadcast_stats;
+
 	void *output_stream_thread();
 	static void *output_stream_thread(void*);
 
@@ -141,22 +173,26 @@ private:
 	void *stream_cb_priv;
 
 	map_pidtype pids;
+	/* the same, changed from any thread while we stream */
+	snapshot<output_filter> filter_state;
 
 	int set_pids(map_pidtype&);
 
-	bool have_pat;
-#if TUNER_RESOURCE_SHARING
+	/* our PAT as last sent */
 	uint8_t pat_pkt[188];
+	uint8_t pat_cc;
 
-	bool want_pid(uint16_t pid) { return ((!pids.size()) || (pids.count(pid))) ? true : false; }
-	bool want_pkt(uint8_t *p) { return ((p) && (want_pid(((p[1] & 0x1f) << 8) | p[2]))); }
-#else
-	bool want_pid(uint16_t pid) { (void)pid; return true; }
-	bool want_pkt(uint8_t *p) { (void)p; return true; }
-#endif
+	/* a chunk of the broadcast ring, copied out and filtered before it is sent */
+	uint8_t filter_buf[188*21];
+
+	/* p, our PAT in its place, or NULL to drop it */
+	const uint8_t *filter_pkt(const output_filter *f, const uint8_t *p);
+	int filter(const output_filter *f, const uint8_t *p, int size, uint8_t *out);
 };
 
 typedef std::map<unsigned int, output_stream> output_stream_map;
+/* the streams of an output_stream_map that are to be pushed to */
+typedef std::vector<output_stream*> output_stream_list;
 
 class output : public socket_listen_iface
 {
@@ -192,12 +228,22 @@ public:
 
 	bool check();
 
+	/* the intermediate buffer, or a single output_stream by target id */
+	void get_stats(rbuf_stats_t*);
+	bool get_stats(int target_id, rbuf_stats_t*);
+
 	int get_pids(map_pidtype&);
 	void reset_pids(int target_id);
+	/* for every stream, whenever the PAT or the streams change */
+	void set_programs(uint16_t ts_id, uint8_t version, const map_pidtype &programs);
 
 	void accept_socket(int sock) { add_http_client(sock); }
 private:
+	/* changed under active.lock(), which control paths that walk it hold too */
 	output_stream_map output_streams;
+	/* what the packet path walks, republished whenever the above changes */
+	snapshot<output_stream_list> active;
+	void publish_active();
 
 	pthread_t h_thread;
 	bool f_kill_thread;
@@ -205,12 +251,15 @@ private:
 
 	rbuf ringbuffer;
 
+	/* written once per packet, read by every output_stream */
+	rbuf_broadcast broadcast;
+
 	void *output_thread();
 	static void *output_thread(void*);
 
 	void add_http_client(int);
 
-	void stop_without_wait() { f_kill_thread = true; }
+	void stop_without_wait() { f_kill_thread = true; ringbuffer.notify(); broadcast.notify(); }
 
 	void reclaim_resources();
 
@@ -20,6 +20,8 @@
  *****************************************************************************/
 
 #define DBG 0
+#include <algorithm>
+#include <inttypes.h>
 #if 1
 #include <stdio.h>
 #endif
@@ -28,15 +30,12 @@
 
 #include "parse.h"
 #include "functions.h"
+#include "tssync.h"
 #include "log.h"
 #define CLASS_MODULE "parse"
 
 const char *parse_libdvbpsi_version = EXPAND_AND_QUOTE(DVBPSI_VERSION);
 
-#if USE_STATIC_DECODE_MAP
-static map_decoder   decoders;
-#endif
-
 #define dprintf(fmt, arg...) __dprintf(DBG_PARSE, fmt, ##arg)
 
 #define PID_PAT  0x00
@@ -153,7 +152,7 @@ void parse::rewrite_pat()
 #endif
 	dvbpsi_pat_t pat;
 	dvbpsi_psi_section_t* p_section;
-	const decoded_pat_t *decoded_pat = decoders[ts_id].get_decoded_pat();
+	const decoded_pat_t *decoded_pat = get_decoder(ts_id).get_decoded_pat();
 
 	if (rewritten_pat_ver_offset == 0x1e)
 		rewritten_pat_ver_offset = 0;
@@ -194,6 +193,7 @@ void parse::process_pat(const decoded_pat_t *decoded_pat)
 				rcvd_pmt[iter->first] = false;
 			}
 		}
+	pid_table_stale = true;
 }
 
 bool parse::take_pat(dvbpsi_pat_t* p_pat, bool decoded)
@@ -215,10 +215,14 @@ bool parse::take_pat(dvbpsi_pat_t* p_pat, bool decoded)
 		if (!dvbpsi_decoder_present(h_demux[PID_ATSC].get_handle()))
 			dvbpsi_AttachDemux(h_demux[PID_ATSC].get_handle(), attach_table, this);
 #endif
+		pid_table_stale = true;
 		return true;
 	}
 
-	process_pat(decoders[p_pat->i_ts_id].get_decoded_pat());
+	const decoded_pat_t *decoded_pat = get_decoder(p_pat->i_ts_id).get_decoded_pat();
+
+	process_pat(decoded_pat);
+	out.set_programs(decoded_pat->ts_id, decoded_pat->version, decoded_pat->programs);
 
 	rewrite_pat();
 
@@ -238,6 +242,7 @@ void parse::process_pmt(const decoded_pmt_t *pmt)
 			payload_pids[iter_pmt_es->second.pid] = iter_pmt_es->second.type;
 			add_filter(iter_pmt_es->second.pid);
 	}
+	pid_table_stale = true;
 }
 
 bool parse::take_pmt(dvbpsi_pmt_t* p_pmt, bool decoded)
@@ -248,7 +253,7 @@ bool parse::take_pmt(dvbpsi_pmt_t* p_pmt, bool decoded)
 
 	if (!decoded) return true;
 
-	const map_decoded_pmt* decoded_pmt = decoders[ts_id].get_decoded_pmt();
+	const map_decoded_pmt* decoded_pmt = get_decoder(ts_id).get_decoded_pmt();
 
 	map_decoded_pmt::const_iterator iter_pmt = decoded_pmt->find(p_pmt->i_program_number);
 	if (iter_pmt != decoded_pmt->end())
@@ -282,7 +287,7 @@ bool parse::take_vct(dvbpsi_atsc_vct_t* p_vct, bool decoded)
 
 void parse::process_mgt(bool attach)
 {
-	const decoded_mgt_t* decoded_mgt = decoders[ts_id].get_decoded_mgt();
+	const decoded_mgt_t* decoded_mgt = get_decoder(ts_id).get_decoded_mgt();
 
 	bool b_expecting_vct = false;
 
@@ -363,6 +368,7 @@ void parse::process_mgt(bool attach)
 		}
 	}
 	expect_vct = b_expecting_vct;
+	pid_table_stale = true;
 }
 
 bool parse::take_mgt(dvbpsi_atsc_mgt_t* p_mgt, bool decoded)
@@ -599,31 +605,17 @@ void parse::attach_table(dvbpsi_t *p_dvbpsi, uint8_t i_table_id, uint16_t i_exte
 	}
 }
 
-#if USE_STATIC_DECODE_MAP
-#define define_table_wrapper(a, b, c, d)				\
-void parse::a(void* p_this, b* p_table)					\
-{									\
-	parse* parser = (parse*)p_this;					\
-	if ((parser) &&							\
-	    (((parser->a(p_table, false)) && (parser->get_ts_id())) &&	\
-	     ((decoders[parser->get_ts_id()].a(p_table)) ||		\
-	      (!parser->d))))						\
-		parser->a(p_table, true);				\
-	c(p_table);							\
-}
-#else
 #define define_table_wrapper(a, b, c, d)				\
 void parse::a(void* p_this, b* p_table)					\
 {									\
 	parse* parser = (parse*)p_this;					\
 	if ((parser) &&							\
 	    (((parser->a(p_table, false)) && (parser->get_ts_id())) &&	\
-	     ((parser->decoders[parser->get_ts_id()].a(p_table)) ||	\
+	     ((parser->get_decoder(parser->get_ts_id()).a(p_table)) ||	\
 	      (!parser->d))))						\
 		parser->a(p_table, true);				\
 	c(p_table);							\
 }
-#endif /* USE_STATIC_DECODE_MAP */
 
 #if USING_DVBPSI_VERSION_0
 #define dvbpsi_pat_delete dvbpsi_DeletePAT
@@ -672,9 +664,9 @@ uint8_t parse::grab_next_eit(uint8_t current_eit_x)
 	if (!eit_x_complete(current_eit_x))
 		return current_eit_x;
 
-	map_decoded_mgt_tables::const_iterator iter = decoders[ts_id].get_decoded_mgt()->tables.find(0x0100 + current_eit_x);
+	map_decoded_mgt_tables::const_iterator iter = get_decoder(ts_id).get_decoded_mgt()->tables.find(0x0100 + current_eit_x);
 
-	if (iter != decoders[ts_id].get_decoded_mgt()->tables.end()) {
+	if (iter != get_decoder(ts_id).get_decoded_mgt()->tables.end()) {
 		map_dvbpsi::const_iterator iter_demux = h_demux.find(iter->second.pid);
 		if (iter_demux != h_demux.end()) {
 			//dvbpsi_DetachDemux(h_demux[iter->second.pid]);
@@ -687,9 +679,9 @@ uint8_t parse::grab_next_eit(uint8_t current_eit_x)
 		goto eit_complete;
 
 	//map_decoded_mgt_tables::const_iterator
-	iter = decoders[ts_id].get_decoded_mgt()->tables.find(0x0100 + current_eit_x + 1);
+	iter = get_decoder(ts_id).get_decoded_mgt()->tables.find(0x0100 + current_eit_x + 1);
 
-	if (iter == decoders[ts_id].get_decoded_mgt()->tables.end())
+	if (iter == get_decoder(ts_id).get_decoded_mgt()->tables.end())
 		goto eit_complete;
 
 	h_demux[iter->second.pid] = dvbpsi_AttachDemux(attach_table, this);
@@ -708,6 +700,7 @@ parse::parse()
   : statistics(CLASS_MODULE)
   , fed_pkt_count(0)
   , ts_id(0)
+  , routes_version(0)
   , epg_mode(false)
   , scan_mode(false)
   , dont_collect_ett(true)
@@ -722,17 +715,23 @@ parse::parse()
   , process_err_pkts(false)
   , tei_count(0)
   , m_tsfilter_iface(NULL)
+  , m_splitter(NULL)
   , enabled(true)
   , rewritten_pat_ver_offset(0)
   , rewritten_pat_cont_ctr(0)
-{
-	if (!hello)
+  , carry_len(0)
+  , sync_loss_count(0)
+  , sync_loss_bytes(0)
+  , pid_table(8192)
+  , pid_table_stale(true)
+{
+	/* parsers may be constructed on several threads at once */
+	if (!__atomic_exchange_n(&hello, true, __ATOMIC_RELAXED))
 		fprintf(stdout, "# dvbtee v" LIBDVBTEE_VERSION
 #if 0
 			", built " __DATE__ " " __TIME__
 #endif
 			" - http://github.com/mkrufky/libdvbtee\n\n");
-	hello = true;
 	dprintf("()");
 
 	memset(&new_channel_info, 0, sizeof(channel_info_t));
@@ -775,6 +774,8 @@ parse::~parse()
 #if 1//DBG
 	if (fed_pkt_count)
 		fprintf(stderr, "%d packets read in total\n", fed_pkt_count);
+	if (sync_loss_count)
+		fprintf(stderr, "%d sync losses, %" PRIu64 " bytes skipped\n", sync_loss_count, sync_loss_bytes);
 #endif
 	service_ids.clear();
 	rcvd_pmt.clear();
@@ -818,6 +819,15 @@ void parse::detach_demux()
 	rcvd_pmt.clear();
 	payload_pids.clear();
 	out_pids.clear();
+	pid_table_stale = true;
+
+	/* and forget what was asked of us */
+	routes.lock();
+	parse_routes *r = new parse_routes;
+	r->version = routes.get()->version + 1;
+	routes.publish(r);
+	routes_version = r->version;
+	routes.unlock();
 }
 
 void parse::stop()
@@ -839,8 +849,8 @@ void parse::cleanup()
 	dprintf("()");
 
 	detach_demux();
-	clear_decoded_networks();
 	decoders.clear();
+	networks.clear();
 	channel_info.clear();
 }
 
@@ -865,6 +875,9 @@ void parse::reset()
 	ts_id = 0;
 	dumped_eit = 0;
 	tei_count = 0;
+	carry_len = 0;
+	sync_loss_count = 0;
+	sync_loss_bytes = 0;
 	has_pat = false;
 	has_mgt = false;
 	has_vct = false;
@@ -899,12 +912,7 @@ void parse::reset()
 	reset_filters();
 }
 
-inline uint16_t tp_pkt_pid(uint8_t* pkt)
-{
-	return (pkt[0] == 0x47) ? ((uint16_t) (pkt[1] & 0x1f) << 8) + pkt[2] : (uint16_t) - 1;
-}
-
-static const char * xine_chandump(parsed_channel_info_t *c)
+const char * xine_chandump(parsed_channel_info_t *c)
 {
 	char channelno[7]; /* XXX.XXX */
 	if (c->major + c->minor > 1)
@@ -961,9 +969,9 @@ void parse::parse_channel_info(const uint16_t ts_id, const decoded_pmt_t* decode
 		for ( int i = 0; i < 7; ++i ) c.service_name[i] = iter_vct->second.short_name[i*2+1];
 		c.service_name[7] = 0;
 	} else { // FIXME: use SDT info
-		c.lcn = decoders[ts_id].get_lcn(c.program_number);
+		c.lcn = get_decoder(ts_id).get_lcn(c.program_number);
 
-		decoded_sdt_t *decoded_sdt = (decoded_sdt_t*)decoders[ts_id].get_decoded_sdt();
+		decoded_sdt_t *decoded_sdt = (decoded_sdt_t*)get_decoder(ts_id).get_decoded_sdt();
 		if ((decoded_sdt) && (decoded_sdt->services.count(c.program_number)))
 			snprintf((char*)c.service_name, sizeof(c.service_name), "%s", decoded_sdt->services[c.program_number].service_name);
 		else {
@@ -981,11 +989,12 @@ unsigned int parse::xine_dump(uint16_t ts_id, channel_info_t* channel_info, pars
 
 	int count = 0;
 
-	const decoded_pat_t* decoded_pat = decoders[ts_id].get_decoded_pat();
-	const map_decoded_pmt* decoded_pmt = decoders[ts_id].get_decoded_pmt();
-	const decoded_vct_t* decoded_vct = decoders[ts_id].get_decoded_vct();
+	const decoded_pat_t* decoded_pat = get_decoder(ts_id).get_decoded_pat();
+	const map_decoded_pmt* decoded_pmt = get_decoder(ts_id).get_decoded_pmt();
+	const decoded_vct_t* decoded_vct = get_decoder(ts_id).get_decoded_vct();
 
-	fprintf(stdout, "\n# channel %d, %d, %s %s\n", c.physical_channel, c.freq, "", "");
+	if (!iface)
+		fprintf(stdout, "\n# channel %d, %d, %s %s\n", c.physical_channel, c.freq, "", "");
 
 	if (decoders.count(ts_id))
 	for (map_decoded_pat_programs::const_iterator iter_pat = decoded_pat->programs.begin();
@@ -1046,7 +1055,7 @@ void parse::epg_dump(decode_report *reporter)
 		channels[iter->second.channel] = iter->first;
 
 	for (map_chan_to_ts_id::iterator iter = channels.begin(); iter != channels.end(); ++iter)
-		if (decoders.count(iter->second)) decoders[iter->second].dump_epg(reporter);
+		if (decoders.count(iter->second)) get_decoder(iter->second).dump_epg(reporter);
 
 	channels.clear();
 
@@ -1065,12 +1074,12 @@ bool parse::get_stream_info(unsigned int channel, uint16_t service, parsed_chann
 	if (!channel_info.count(requested_ts_id))
 		return false;
 
-	const map_decoded_pmt* decoded_pmt = decoders[requested_ts_id].get_decoded_pmt();
+	const map_decoded_pmt* decoded_pmt = get_decoder(requested_ts_id).get_decoded_pmt();
 	map_decoded_pmt::const_iterator iter_pmt = decoded_pmt->find(service);
 	if (iter_pmt == decoded_pmt->end())
 		return false;
 
-	const decoded_vct_t* decoded_vct = decoders[requested_ts_id].get_decoded_vct();
+	const decoded_vct_t* decoded_vct = get_decoder(requested_ts_id).get_decoded_vct();
 
 	channel_info_t *info = &channel_info[requested_ts_id];
 
@@ -1091,11 +1100,11 @@ bool parse::get_stream_info(unsigned int channel, uint16_t service, parsed_chann
 	time(&last);
 
 	if (e0) {
-		decoders[requested_ts_id].get_epg_event(service, last, e0);
+		get_decoder(requested_ts_id).get_epg_event(service, last, e0);
 		last = e0->start_time + e0->length_sec + 1;
 	}
 	if (e1)
-		decoders[requested_ts_id].get_epg_event(service, last, e1);
+		get_decoder(requested_ts_id).get_epg_event(service, last, e1);
 
 	return true;
 }
@@ -1103,7 +1112,7 @@ bool parse::get_stream_info(unsigned int channel, uint16_t service, parsed_chann
 bool parse::is_pmt_ready(uint16_t id)
 {
 #if 0
-	return (has_pat && decoders[get_ts_id()].complete_pmt());
+	return (has_pat && get_decoder(get_ts_id()).complete_pmt());
 #endif
 	if ((!has_pat) || (!rcvd_pmt.size()))
 		return false;
@@ -1128,7 +1137,7 @@ bool parse::is_psip_ready()
 
 bool parse::is_epg_ready()
 {
-	return ((is_psip_ready()) && ((decoders.count(get_ts_id()) && (decoders[get_ts_id()].got_all_eit(eit_collection_limit)))));
+	return ((is_psip_ready()) && ((decoders.count(get_ts_id()) && (get_decoder(get_ts_id()).got_all_eit(eit_collection_limit)))));
 }
 
 int parse::add_output(void* priv, stream_callback callback)
@@ -1212,11 +1221,12 @@ int parse::add_output(void* priv, stream_callback callback, map_pidtype &pids)
 	if (target_id < 0)
 		goto fail;
 
+
 	ret = out.start();
 	if (ret < 0)
 		return ret;
 
-	out.get_pids(out_pids);
+	publish_routes(NULL);
 	dprintf("success adding callback target id:%4d", target_id);
 fail:
 	return target_id;
@@ -1228,11 +1238,12 @@ int parse::add_output(int socket, unsigned int method, map_pidtype &pids)
 	if (target_id < 0)
 		goto fail;
 
+
 	ret = out.start();
 	if (ret < 0)
 		return ret;
 
-	out.get_pids(out_pids);
+	publish_routes(NULL);
 	dprintf("success adding socket target id:%4d", target_id);
 fail:
 	return target_id;
@@ -1244,11 +1255,12 @@ int parse::add_output(char* target, map_pidtype &pids)
 	if (target_id < 0)
 		goto fail;
 
+
 	ret = out.start();
 	if (ret < 0)
 		return ret;
 
-	out.get_pids(out_pids);
+	publish_routes(NULL);
 	dprintf("success adding url target id:%4d", target_id);
 fail:
 	return target_id;
@@ -1285,11 +1297,12 @@ int parse::add_stdout(map_pidtype &pids)
 	if (target_id < 0)
 		goto fail;
 
+
 	ret = out.start();
 	if (ret < 0)
 		return ret;
 
-	out.get_pids(out_pids);
+	publish_routes(NULL);
 	dprintf("success adding stdout target id:%4d", target_id);
 fail:
 	return target_id;
@@ -1299,12 +1312,12 @@ fail:
 
 void parse::add_service_pids(uint16_t service_id, map_pidtype &pids)
 {
-	const decoded_pat_t* decoded_pat = decoders[ts_id].get_decoded_pat();
+	const decoded_pat_t* decoded_pat = get_decoder(ts_id).get_decoded_pat();
 	map_decoded_pat_programs::const_iterator iter_pat = decoded_pat->programs.find(service_id);
 	if (iter_pat != decoded_pat->programs.end())
 		pids[iter_pat->second] = 0;//FIXME
 
-	const map_decoded_pmt* decoded_pmt = decoders[ts_id].get_decoded_pmt();
+	const map_decoded_pmt* decoded_pmt = get_decoder(ts_id).get_decoded_pmt();
 	map_decoded_pmt::const_iterator iter_pmt = decoded_pmt->find(service_id);
 	if (iter_pmt != decoded_pmt->end()) {
 
@@ -1328,29 +1341,87 @@ void parse::add_service_pids(char* service_ids, map_pidtype &pids)
 
 void parse::add_service_pids(map_pidtype &pids)
 {
-	if (!service_ids.size()) return;
-	for (map_pidtype::const_iterator iter = service_ids.begin(); iter != service_ids.end(); ++iter)
+	routes.lock();
+	map_pidtype ids = routes.get()->service_ids;
+	routes.unlock();
+
+	for (map_pidtype::const_iterator iter = ids.begin(); iter != ids.end(); ++iter)
 		add_service_pids(iter->first, pids);
 }
 
 void parse::set_service_ids(char *ids)
 {
 	char *save, *id = (ids) ? strtok_r(ids, CHAR_CMD_COMMA, &save) : NULL;
-
-	service_ids.clear();
-	payload_pids.clear();
+	map_pidtype new_ids;
 
 	if (id) while (id) {
-		if (id) set_service_id(strtoul(id, NULL, 0));
+		if (id) new_ids[strtoul(id, NULL, 0)] = 0;
 		id = strtok_r(NULL, CHAR_CMD_COMMA, &save);
 	} else
-		if (ids) set_service_id(strtoul(ids, NULL, 0));
+		if (ids) new_ids[strtoul(ids, NULL, 0)] = 0;
+
+	/* taken up by the feeding thread, see apply_routes() */
+	publish_routes(&new_ids);
+}
+
+void parse::reset_output_pids(int target_id)
+{
+	out.reset_pids(target_id);
+	publish_routes(NULL);
+}
+
+/* service_ids, unless NULL, replaces the services asked for.  the pids
+ * that the outputs want are gathered afresh */
+void parse::publish_routes(const map_pidtype *ids)
+{
+	routes.lock();
+	parse_routes *r = new parse_routes(*routes.get());
+
+	if (ids)
+		r->service_ids = *ids;
+	r->out_pids.clear();
+	out.get_pids(r->out_pids);
+	r->version++;
+
+	routes.publish(r);
+	routes.unlock();
+}
+
+/* feeding thread only, so that nothing here changes under its feet */
+void parse::apply_routes()
+{
+	unsigned int idx;
+	const parse_routes *r = routes.read_lock(&idx);
+
+	if (r->version == routes_version) {
+		routes.read_unlock(idx);
+		return;
+	}
+	bool services_changed = (r->service_ids != service_ids);
+
+	service_ids = r->service_ids;
+	out_pids = r->out_pids;
+	routes_version = r->version;
+	routes.read_unlock(idx);
+
+	pid_table_stale = true;
+
+	/* outputs may have come or gone, or changed their pids */
+	if (has_pat) {
+		const decoded_pat_t* decoded_pat = get_decoder(ts_id).get_decoded_pat();
+		out.set_programs(decoded_pat->ts_id, decoded_pat->version, decoded_pat->programs);
+	}
+
+	if (!services_changed)
+		return;
+
+	payload_pids.clear();
 
 	if (has_pat) {
 		rewrite_pat();
 
-		const decoded_pat_t* decoded_pat = decoders[ts_id].get_decoded_pat();
-		const map_decoded_pmt* decoded_pmt = decoders[ts_id].get_decoded_pmt();
+		const decoded_pat_t* decoded_pat = get_decoder(ts_id).get_decoded_pat();
+		const map_decoded_pmt* decoded_pmt = get_decoder(ts_id).get_decoded_pmt();
 
 		process_pat(decoded_pat);
 
@@ -1400,7 +1471,7 @@ void parse::set_ts_id(uint16_t new_ts_id)
 	dprintf("(%04x|%d)\n", new_ts_id, new_ts_id);
 	ts_id = new_ts_id;
 	memcpy(&channel_info[ts_id], &new_channel_info, sizeof(channel_info_t));
-	decoders[ts_id].set_physical_channel(channel_info[ts_id].channel);
+	get_decoder(ts_id).set_physical_channel(channel_info[ts_id].channel);
 }
 
 uint16_t parse::get_ts_id(unsigned int channel)
@@ -1424,152 +1495,256 @@ int parse::feed(int count, uint8_t* p_data)
 		return -1;
 	}
 
-	uint8_t* p = p_data;
-	if (!enabled)
-		out.push(p, count);
-	else
-	/* one TS packet at a time */
-	for (int i = count / 188; i > 0; --i) {
-		bool send_pkt = false;
-		unsigned int sync_offset = 0;
-		output_options out_type = OUTPUT_NONE;
-		pkt_stats_t pkt_stats;
-
-		statistics.parse(p, &pkt_stats);
-
-		while (((i > 0) && (pkt_stats.pid == (uint16_t) - 1)) || ((i > 1) && (tp_pkt_pid(p+188) == (uint16_t) - 1))) {
-			p++;
-			sync_offset++;
-			if (sync_offset == 188) {
-				sync_offset = 0;
-				i--;
-				fprintf(stderr, "\nSYNC LOSS\n\n");
-			}
-			statistics.parse(p, &pkt_stats);
-			fprintf(stderr, ".\t");
+	/* complete the packet left over from the previous call */
+	if (carry_len) {
+		int len = 188 - carry_len;
+		if (len > count) {
+			memcpy(carry_pkt + carry_len, p_data, count);
+			carry_len += count;
+			return 0;
 		}
-
-		if (sync_offset) fprintf(stderr, "\nSYNC LOSS\n\n");
-#if 0
-		/* demux & statistics for entire read TS */
-		statistics.push(p, &pkt_stats);
-		demuxer.push(pkt_stats.pid, p);
-#endif
-		if (pkt_stats.tei) {
-			if (!tei_count)
-				fprintf(stderr, "\tTEI");//"%s: TEI detected, dropping packet\n", __func__);
-			else if (tei_count % 100 == 0)
-				fprintf(stderr, ".");
-			tei_count++;
-			if (!process_err_pkts) continue;
+		if ((len < count) && (p_data[len] != 0x47)) {
+			/* no packet follows, the carried sync byte was a false one */
+			sync_loss_count++;
+			sync_loss_bytes += carry_len;
+		} else {
+			memcpy(carry_pkt + carry_len, p_data, len);
+			p_data += len;
+			count -= len;
+			feed_packets(188, carry_pkt);
 		}
+		carry_len = 0;
+	}
 
-		switch (pkt_stats.pid) {
-		case PID_PAT:
-#if USING_DVBPSI_VERSION_0
-			dvbpsi_PushPacket(h_pat, p);
-#else
-			h_pat.packet_push(p);
-#endif
-			send_pkt = (service_ids.size()) ? false : true;
-			out_type = OUTPUT_PATPMT;
-			if (!send_pkt) {
-				pat_pkt[3] = (0x0f & ++rewritten_pat_cont_ctr) | 0x10;
-				out.push(pat_pkt, out_type);
-			}
-			break;
+	/* and keep whatever doesn't make up a whole packet for the next */
+	int used = feed_packets(count, p_data);
+	if (used < count) {
+		carry_len = count - used;
+		memcpy(carry_pkt, p_data + used, carry_len);
+	}
+
+	return 0;
+}
+
+/* flattens the pids of h_pmt, eit_pids, h_demux, payload_pids and
+ * out_pids into pid_table, so that a packet is classified by one lookup */
+void parse::update_pid_table()
+{
+	pid_entry none;
+	memset(&none, 0, sizeof(none));
+	std::fill(pid_table.begin(), pid_table.end(), none);
+
+	for (map_dvbpsi::iterator iter = h_pmt.begin(); iter != h_pmt.end(); ++iter) {
+		pid_table[iter->first & 0x1fff].action |= PID_ACTION_PMT;
+		pid_table[iter->first & 0x1fff].handler = &iter->second;
+	}
+	for (map_pidtype::const_iterator iter = eit_pids.begin(); iter != eit_pids.end(); ++iter) {
+		pid_table[iter->first & 0x1fff].action |= PID_ACTION_EIT;
+		pid_table[iter->first & 0x1fff].eit_x = iter->second;
+	}
+	for (map_dvbpsi::iterator iter = h_demux.begin(); iter != h_demux.end(); ++iter) {
+		pid_entry &entry = pid_table[iter->first & 0x1fff];
+		entry.action |= PID_ACTION_DEMUX;
+		/* PMT takes precedence */
+		if (!entry.handler)
+			entry.handler = &iter->second;
+	}
+	for (map_pidtype::const_iterator iter = payload_pids.begin(); iter != payload_pids.end(); ++iter)
+		pid_table[iter->first & 0x1fff].action |= PID_ACTION_PES;
+	for (map_pidtype::const_iterator iter = out_pids.begin(); iter != out_pids.end(); ++iter)
+		pid_table[iter->first & 0x1fff].action |= PID_ACTION_PES;
+
+	/* the decoders may be new, let them see every section once more */
+	for (std::map<uint16_t, section_filter>::iterator iter = section_filters.begin(); iter != section_filters.end(); ++iter)
+		iter->second.reset();
+
+	pid_table[PID_PAT].filter = &section_filters[PID_PAT];
+	for (map_dvbpsi::iterator iter = h_pmt.begin(); iter != h_pmt.end(); ++iter)
+		pid_table[iter->first & 0x1fff].filter = &section_filters[iter->first & 0x1fff];
+	for (map_dvbpsi::iterator iter = h_demux.begin(); iter != h_demux.end(); ++iter)
+		switch (iter->first) {
 		case PID_ATSC:
 		case PID_NIT:
 		case PID_SDT:
-		case PID_TOT:
-		case PID_EIT:
-			send_pkt = true;
-			out_type = OUTPUT_PSIP;
-			/* fall-thru */
-		default:
-#if USING_DVBPSI_VERSION_0
-			map_dvbpsi::const_iterator iter;
-#else
-			map_dvbpsi::iterator iter;
-#endif
+			pid_table[iter->first].filter = &section_filters[iter->first];
+			break;
+		}
 
-			iter = h_pmt.find(pkt_stats.pid);
-			if (iter != h_pmt.end()) {
+	pid_table_stale = false;
+}
+
+static void push_section(void *priv, const uint8_t *p)
+{
 #if USING_DVBPSI_VERSION_0
-				dvbpsi_PushPacket(iter->second, p);
+	dvbpsi_PushPacket(*(dvbpsi_handle*)priv, (uint8_t*)p);
 #else
-				iter->second.packet_push(p);
+	((dvbpsi_class*)priv)->packet_push((uint8_t*)p);
 #endif
+}
 
-				send_pkt = true;
-				out_type = OUTPUT_PATPMT;
+int parse::feed_packets(int count, uint8_t* p_data)
+{
+	uint8_t* p = p_data;
+	uint8_t* end = p_data + count;
+
+	apply_routes();
+
+	if (!enabled) {
+		count -= count % 188;
+		out.push(p, count);
+		if (m_splitter)
+			m_splitter->push(p, count);
+		return count;
+	}
+
+	/* runs of up to STATS_BATCH packets, headers decoded up front */
+	while (end - p >= 188) {
+		pkt_hdr_batch_t hdrs;
+
+		if ((p[0] != 0x47) || ((end - p >= 376) && (p[188] != 0x47))) {
+			int skip = ts_sync_offset(p, end - p);
+
+			sync_loss_count++;
+			sync_loss_bytes += skip;
+			dprintf("sync loss, skipping %d bytes", skip);
+
+			p += skip;
+			if (end - p < 188)
 				break;
+		}
+
+		int n = statistics.parse((end - p) / 188, p, &hdrs);
+
+		/* stop short of a sync loss, along with the packet before it,
+		 * and let the check above resync.  the first packet always
+		 * passes, as the check above has seen the sync byte after it */
+		int run = 0;
+		while ((run < n) && (hdrs.pid[run] != (uint16_t) - 1))
+			run++;
+		if (run < n)
+			run--;
+		else if ((end - (p + n * 188) >= 188) && (p[n * 188] != 0x47))
+			run--;
+
+		if ((m_splitter) && (run > 0))
+			m_splitter->push(p, run * 188);
+
+		for (int i = 0; i < run; i++, p += 188) {
+			bool send_pkt = false;
+			output_options out_type = OUTPUT_NONE;
+			uint16_t pid = hdrs.pid[i];
+#if 0
+			/* demux & statistics for entire read TS */
+			statistics.push(p, &hdrs, i);
+			demuxer.push(pid, p);
+#endif
+			if (hdrs.tei[i]) {
+				if (!tei_count)
+					fprintf(stderr, "\tTEI");//"%s: TEI detected, dropping packet\n", __func__);
+				else if (tei_count % 100 == 0)
+					fprintf(stderr, ".");
+				tei_count++;
+				if (!process_err_pkts) continue;
 			}
 
-			map_pidtype::const_iterator iter_eit;
-			iter_eit = eit_pids.find(pkt_stats.pid);
-			if (iter_eit != eit_pids.end()) {
+			if (pid_table_stale)
+				update_pid_table();
 
-				if (decoders[ts_id].eit_x_complete(iter_eit->second)) {
-					if (h_demux.count(iter_eit->first)) {
+			switch (pid) {
+			case PID_PAT:
+				pid_table[PID_PAT].filter->push(p, push_section, &h_pat);
+				send_pkt = (service_ids.size()) ? false : true;
+				out_type = OUTPUT_PATPMT;
+				if (!send_pkt) {
+					pat_pkt[3] = (0x0f & ++rewritten_pat_cont_ctr) | 0x10;
+					out.push(pat_pkt, out_type);
+				}
+				break;
+			case PID_ATSC:
+			case PID_NIT:
+			case PID_SDT:
+			case PID_TOT:
+			case PID_EIT:
+				send_pkt = true;
+				out_type = OUTPUT_PSIP;
+				/* fall-thru */
+			default:
+			{
+				const pid_entry &entry = pid_table[pid];
+
+				if (entry.action & PID_ACTION_PMT) {
+					entry.filter->push(p, push_section, entry.handler);
+
+					send_pkt = true;
+					out_type = OUTPUT_PATPMT;
+					break;
+				}
+
+				if (entry.action & PID_ACTION_EIT) {
+
+					if (get_decoder(ts_id).eit_x_complete(entry.eit_x)) {
+						if (h_demux.count(pid)) {
 #if USING_DVBPSI_VERSION_0
-						dvbpsi_DetachDemux(h_demux[iter_eit->first]);
+							dvbpsi_DetachDemux(h_demux[pid]);
 #else
-						h_demux[iter_eit->first].detach_demux();
-#endif
-						h_demux.erase(iter_eit->first);
+							h_demux[pid].detach_demux();
+#endif
+							h_demux.erase(pid);
+						}
+						eit_pids.erase(pid);
+						pid_table_stale = true;
+						//epg_complete = (eit_pids.size() == 0);
+						continue;
 					}
-					eit_pids.erase(iter_eit->first);
-					//epg_complete = (eit_pids.size() == 0);
-					continue;
+					get_decoder(ts_id).set_current_eit_x(entry.eit_x);
+					out_type = OUTPUT_PSIP;
 				}
-				decoders[ts_id].set_current_eit_x(iter_eit->second);
-				out_type = OUTPUT_PSIP;
-			}
 
-			iter = h_demux.find(pkt_stats.pid);
-			if (iter != h_demux.end()) {
+				if (entry.action & PID_ACTION_DEMUX) {
+					if (entry.filter)
+						entry.filter->push(p, push_section, entry.handler);
+					else
 #if USING_DVBPSI_VERSION_0
-				dvbpsi_PushPacket(iter->second, p);
+						dvbpsi_PushPacket(*entry.handler, p);
 #else
-				iter->second.packet_push(p);
+						entry.handler->packet_push(p);
 #endif
 
-				send_pkt = true;
-				//if (!out_type) out_type = OUTPUT_PSIP;
-				break;
-			}
+					send_pkt = true;
+					//if (!out_type) out_type = OUTPUT_PSIP;
+					break;
+				}
 
-			if ((payload_pids.count(pkt_stats.pid)) ||
-			    (out_pids.count(pkt_stats.pid))) {
-				send_pkt = true;
-				out_type = OUTPUT_PES;
-				break;
+				if (entry.action & PID_ACTION_PES) {
+					send_pkt = true;
+					out_type = OUTPUT_PES;
+					break;
+				}
 			}
-		}
-		if (send_pkt) {
-			out.push(p, out_type);
+			}
+			if (send_pkt) {
+				out.push(p, out_type);
 #if 1
-			/* demux & statistics for selected PIDs */
-			statistics.push(p, &pkt_stats);
+				/* demux & statistics for selected PIDs */
+				statistics.push(p, &hdrs, i);
 #ifdef DVBTEE_DEMUXER
-			demuxer.push(pkt_stats.pid, p);
+				demuxer.push(pid, p);
 #endif
 #endif
-		}
+			}
 #if DBG
-		addpid(pid);
+			addpid(pid);
 #endif
-		p += 188;
-		fed_pkt_count++;
+			fed_pkt_count++;
+		}
 	}
 #if 1//DBG
-	while (((decoders.count(ts_id)) && (decoders[ts_id].eit_x_complete(dumped_eit)))) {
-		decoders[ts_id].dump_eit_x(NULL, dumped_eit);
+	while (((decoders.count(ts_id)) && (get_decoder(ts_id).eit_x_complete(dumped_eit)))) {
+		get_decoder(ts_id).dump_eit_x(NULL, dumped_eit);
 		dumped_eit++;
 	}
 #endif
-	return 0;
+	return p - p_data;
 }
 
 #if !USING_DVBPSI_VERSION_0
@@ -1590,17 +1765,16 @@ static void dvbpsi_message(dvbpsi_t *handle, const dvbpsi_msg_level_t level, con
 }
 
 dvbpsi_class::dvbpsi_class()
-  : handle(dvbpsi_new(&dvbpsi_message, DVBPSI_MSG_DEBUG))
+  : handle(NULL)
 {
 #if DBG
 	dprintf("()");
 #endif
-	if (!handle) fprintf(stderr, "\n!!! !!! !!! !!! MK- DVBPSI NOT INITIALIZED!!! !!! !!! !!!\n\n");
 }
 
 dvbpsi_class::~dvbpsi_class()
 {
-	if (dvbpsi_decoder_present(handle)) {
+	if ((handle) && (dvbpsi_decoder_present(handle))) {
 		fprintf(stderr, "\n!!! !!! !!! !!! MK- DVBPSI NOT DETACHED!!! !!! !!! !!!\n\n");
 		detach_demux();
 	}
@@ -1616,8 +1790,7 @@ dvbpsi_class::dvbpsi_class(const dvbpsi_class&)
 #if DBG
 	dprintf("(copy)");
 #endif
-	handle = dvbpsi_new(&dvbpsi_message, DVBPSI_MSG_DEBUG);
-	if (!handle) fprintf(stderr, "\n!!! !!! !!! !!! MK- DVBPSI NOT INITIALIZED!!! !!! !!! !!!\n\n");
+	handle = NULL;
 }
 
 dvbpsi_class& dvbpsi_class::operator= (const dvbpsi_class& cSource)
@@ -1628,12 +1801,23 @@ dvbpsi_class& dvbpsi_class::operator= (const dvbpsi_class& cSource)
 	if (this == &cSource)
 		return *this;
 
-	handle = dvbpsi_new(&dvbpsi_message, DVBPSI_MSG_DEBUG);
-	if (!handle) fprintf(stderr, "\n!!! !!! !!! !!! MK- DVBPSI NOT INITIALIZED!!! !!! !!! !!!\n\n");
+	detach_demux();
+	if (handle) dvbpsi_delete(handle);
+	handle = NULL;
+	tables.clear();
 
 	return *this;
 }
 
+dvbpsi_t* dvbpsi_class::get_handle()
+{
+	if (!handle) {
+		handle = dvbpsi_new(&dvbpsi_message, DVBPSI_MSG_DEBUG);
+		if (!handle) fprintf(stderr, "\n!!! !!! !!! !!! MK- DVBPSI NOT INITIALIZED!!! !!! !!! !!!\n\n");
+	}
+	return handle;
+}
+
 void dvbpsi_class::purge()
 {
 #if DBG
@@ -1641,8 +1825,7 @@ void dvbpsi_class::purge()
 #endif
 	detach_demux();
 	if (handle) dvbpsi_delete(handle);
-	handle = dvbpsi_new(&dvbpsi_message, DVBPSI_MSG_DEBUG);
-	if (!handle) fprintf(stderr, "\n!!! !!! !!! !!! MK- DVBPSI NOT INITIALIZED!!! !!! !!! !!!\n\n");
+	handle = NULL;
 }
 
 void dvbpsi_class::detach_tables()
@@ -28,6 +28,9 @@
 #include "decode.h"
 #include "demux.h"
 #include "output.h"
+#include "secfilter.h"
+#include "snapshot.h"
+#include "splitter.h"
 #include "stats.h"
 
 /* update version number by updating the LIBDVBTEE_VERSION_FOO fields below */
@@ -46,10 +49,8 @@
 
 extern const char *parse_libdvbpsi_version;
 
-
-#define USE_STATIC_DECODE_MAP 1
-
 #include <map>
+#include <vector>
 
 #if !USING_DVBPSI_VERSION_0
 typedef void (*dvbpsi_detach_table_callback)(dvbpsi_t *, uint8_t, uint16_t);
@@ -76,7 +77,8 @@ public:
 	dvbpsi_class& operator= (const dvbpsi_class&);
 
 	bool packet_push(uint8_t* p_data);
-	dvbpsi_t* get_handle() { return handle; }
+	/* created on first use, so that copies made by map inserts are cheap */
+	dvbpsi_t* get_handle();
 	void set_detach(dvbpsi_detach_table_callback cb, uint8_t id, uint16_t ext);
 	void detach_demux();
 
@@ -124,12 +126,27 @@ typedef struct {
 	unsigned char service_name[256];
 } parsed_channel_info_t;
 
+/* what set_service_ids() and the outputs ask of a parser.  published
+ * from any thread, picked up by the one feeding the parser */
+struct parse_routes
+{
+	parse_routes() : version(0) {}
+
+	map_pidtype service_ids;
+	map_pidtype out_pids;
+	unsigned int version;
+};
+
 class parse_iface
 {
 public:
 	virtual void chandump(parsed_channel_info_t *) = 0;
 };
 
+/* prints the channel to stdout as a line of a xine channels.conf,
+ * as xine_dump() does without a parse_iface */
+const char * xine_chandump(parsed_channel_info_t *);
+
 
 class parse
 {
@@ -138,6 +155,9 @@ public:
 	~parse();
 
 	unsigned int get_fed_pkt_count() const { return fed_pkt_count; }
+	/* times the stream had to be resynchronized, and the bytes skipped */
+	unsigned int get_sync_loss_count() const { return sync_loss_count; }
+	uint64_t get_sync_loss_bytes() const { return sync_loss_bytes; }
 	uint16_t get_ts_id() const { return ts_id; }
 	uint16_t get_ts_id(unsigned int channel);
 
@@ -147,10 +167,11 @@ public:
 	void add_service_pids(char* service_ids, map_pidtype &pids);
 	void add_service_pids(map_pidtype &pids);
 
-	void reset_output_pids(int target_id = -1) { out.reset_pids(target_id); }
+	void reset_output_pids(int target_id = -1);
 
 	void set_service_ids(char *ids);
 
+	/* any number of bytes, a packet split across calls is reassembled */
 	int feed(int, uint8_t*);
 	void reset();
 	void stop();
@@ -202,6 +223,9 @@ public:
 
 	void set_tsfilter_iface(tsfilter_iface &iface) { m_tsfilter_iface = &iface; }
 
+	/* also hand everything fed to a splitter, NULL to stop */
+	void set_splitter(splitter *s) { m_splitter = s; }
+
 	output out;
 
 	bool check();
@@ -209,9 +233,12 @@ public:
 
 	stats statistics;
 private:
-#if !USE_STATIC_DECODE_MAP
+	/* ours alone, so that parsers can run on separate threads */
 	map_decoder   decoders;
-#endif
+	map_network_decoder networks;
+
+	decode &get_decoder(uint16_t ts_id) { decode &d = decoders[ts_id]; d.set_networks(&networks); return d; }
+
 	static void take_pat(void*, dvbpsi_pat_t*);
 	static void take_pmt(void*, dvbpsi_pmt_t*);
 	static void take_eit(void*, dvbpsi_eit_t*);
@@ -262,7 +289,6 @@ private:
 	unsigned int xine_dump(uint16_t, channel_info_t*, parse_iface *);
 
 	void set_ts_id(uint16_t);
-	void set_service_id(uint16_t id) { service_ids[id] = 0; }
 	void detach_demux();
 
 	channel_info_t new_channel_info;
@@ -284,6 +310,12 @@ private:
 	uint16_t ts_id;
 	map_pidtype service_ids; // ignore the type name used here
 
+	/* service_ids and out_pids are the feeding thread's copies of these */
+	snapshot<parse_routes> routes;
+	unsigned int routes_version;
+	void apply_routes();
+	void publish_routes(const map_pidtype *service_ids);
+
 	bool epg_mode;
 	bool scan_mode;
 	bool dont_collect_ett;
@@ -306,6 +338,7 @@ private:
 	map_pidtype payload_pids;
 
 	tsfilter_iface *m_tsfilter_iface;
+	splitter *m_splitter;
 	void add_filter(uint16_t pid) { if (m_tsfilter_iface) m_tsfilter_iface->addfilter(pid); }
 	void clear_filters() { if (m_tsfilter_iface) m_tsfilter_iface->addfilter(0xffff); }
 	void reset_filters();
@@ -325,6 +358,36 @@ private:
 	map_pidtype out_pids;
 
 	void parse_channel_info(const uint16_t, const decoded_pmt_t*, const decoded_vct_t*, parsed_channel_info_t&);
+
+	/* the partial packet at the end of the last feed() */
+	uint8_t carry_pkt[188];
+	int carry_len;
+	/* returns the number of bytes used, the rest is less than a packet */
+	int feed_packets(int, uint8_t*);
+
+	unsigned int sync_loss_count;
+	uint64_t sync_loss_bytes;
+
+	enum pid_action {
+		PID_ACTION_PMT   = 0x01,
+		PID_ACTION_EIT   = 0x02,
+		PID_ACTION_DEMUX = 0x04,
+		PID_ACTION_PES   = 0x08,
+	};
+	struct pid_entry {
+		uint8_t action;
+		uint8_t eit_x;
+		/* the PMT decoder or the table demux */
+		map_dvbpsi::mapped_type *handler;
+		/* set for the repetitive tables, which only reach the handler once changed */
+		section_filter *filter;
+	};
+	/* indexed by pid, rebuilt before the next packet once stale */
+	std::vector<pid_entry> pid_table;
+	bool pid_table_stale;
+	void update_pid_table();
+
+	std::map<uint16_t, section_filter> section_filters;
 };
 
 #endif //__PARSE_H__
@@ -21,6 +21,10 @@
 #define DBG 0
 
 #include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 #include "rbuf.h"
 #include "log.h"
 #define CLASS_MODULE "rbuf"
@@ -32,9 +36,20 @@ rbuf::rbuf()
   , p_data(NULL)
   , idx_read(0)
   , idx_write(0)
+  , spsc(false)
+  , mirrored(false)
+  , pos_read(0)
+  , pos_write(0)
+  , wait_threshold(0)
+  , waiting(0)
+  , space_threshold(0)
+  , waiting_space(0)
 {
 	dprintf("()");
 	pthread_mutex_init(&mutex, 0);
+	pthread_mutex_init(&wait_mutex, 0);
+	pthread_cond_init(&wait_cond, 0);
+	memset(&stats, 0, sizeof(stats));
 }
 
 rbuf::~rbuf()
@@ -43,16 +58,30 @@ rbuf::~rbuf()
 
 	dealloc();
 
+	pthread_cond_destroy(&wait_cond);
+	pthread_mutex_destroy(&wait_mutex);
 	pthread_mutex_destroy(&mutex);
 }
 
 rbuf::rbuf(const rbuf&)
 {
 	dprintf("(copy)");
+	pthread_mutex_init(&mutex, 0);
+	pthread_mutex_init(&wait_mutex, 0);
+	pthread_cond_init(&wait_cond, 0);
+	wait_threshold = 0;
+	waiting   = 0;
+	space_threshold = 0;
+	waiting_space = 0;
 	p_data    = NULL;
 	capacity  = 0;
 	idx_read  = 0;
 	idx_write = 0;
+	spsc      = false;
+	mirrored  = false;
+	pos_read  = 0;
+	pos_write = 0;
+	memset(&stats, 0, sizeof(stats));
 }
 
 rbuf& rbuf::operator= (const rbuf& cSource)
@@ -66,6 +95,11 @@ rbuf& rbuf::operator= (const rbuf& cSource)
 	capacity  = 0;
 	idx_read  = 0;
 	idx_write = 0;
+	spsc      = false;
+	mirrored  = false;
+	pos_read  = 0;
+	pos_write = 0;
+	memset(&stats, 0, sizeof(stats));
 
 	return *this;
 }
@@ -75,9 +109,7 @@ void rbuf::dealloc()
 	dprintf("()");
 	pthread_mutex_lock(&mutex);
 
-	if (p_data)
-		delete[] p_data;
-	p_data = NULL;
+	__free();
 
 	capacity = 0;
 	__reset();
@@ -85,16 +117,27 @@ void rbuf::dealloc()
 	pthread_mutex_unlock(&mutex);
 }
 
-void rbuf::set_capacity(int cap)
+void rbuf::set_capacity(int cap, enum rbuf_options opt)
 {
-	dprintf("(%d)", cap);
+	dprintf("(%d%s)", cap,
+		(opt == RBUF_MIRRORED) ? ", mirrored" :
+		(opt == RBUF_SPSC) ? ", spsc" : "");
 	pthread_mutex_lock(&mutex);
 
-	if (p_data)
-		delete[] p_data;
+	__free();
+
+	spsc = (opt & RBUF_SPSC) ? true : false;
+	if (spsc) {
+		/* power of two, so that the free-running positions can be masked */
+		int pow2 = (opt == RBUF_MIRRORED) ? sysconf(_SC_PAGESIZE) : 1;
+		while (pow2 < cap)
+			pow2 <<= 1;
+		cap = pow2;
+	}
 
-	p_data = new char[(capacity = cap)];
+	__alloc((capacity = cap), (opt == RBUF_MIRRORED));
 	__reset();
+	memset(&stats, 0, sizeof(stats));
 
 	pthread_mutex_unlock(&mutex);
 }
@@ -112,6 +155,9 @@ int rbuf::get_size()
 #if DBG
 	dprintf("()");
 #endif
+	if (spsc)
+		return spsc_get_size();
+
 	pthread_mutex_lock(&mutex);
 
 	int ret = __get_size();
@@ -139,16 +185,21 @@ bool rbuf::check()
 	}
 	int size = get_size();
 
-	dprintf("%d.%02d%% usage (%d / %d)",
+	dprintf("%d.%02d%% usage (%d / %d), peak %d, %lu failed writes, %llu bytes dropped",
 		100 * size / capacity,
 		100 * (100 * size % capacity) / capacity,
-		size, capacity);
+		size, capacity, __atomic_load_n(&stats.peak_fill, __ATOMIC_RELAXED),
+		__atomic_load_n(&stats.failed_writes, __ATOMIC_RELAXED),
+		(unsigned long long)__atomic_load_n(&stats.bytes_dropped, __ATOMIC_RELAXED));
 
 	return true;
 }
 
 int rbuf::get_write_ptr(void** p)
 {
+	if (spsc)
+		return spsc_get_write_ptr(p);
+
 	pthread_mutex_lock(&mutex);
 
 	return __get_write_ptr(p);
@@ -156,9 +207,15 @@ int rbuf::get_write_ptr(void** p)
 
 void rbuf::put_write_ptr(int size)
 {
-	__put_write_ptr(size);
+	if (spsc)
+		spsc_put_write_ptr(size);
+	else {
+		__put_write_ptr(size);
 
-	pthread_mutex_unlock(&mutex);
+		pthread_mutex_unlock(&mutex);
+	}
+	__count_in(size);
+	__notify_waiter();
 }
 
 #if 0
@@ -188,11 +245,23 @@ bool rbuf::write(const void* p, int size)
 #else
 bool rbuf::write(const void* p, int size)
 {
+	if (spsc) {
+		if (!spsc_write(p, size)) {
+			__atomic_fetch_add(&stats.failed_writes, 1, __ATOMIC_RELAXED);
+			return false;
+		}
+		__count_in(size);
+		__notify_waiter();
+		return true;
+	}
+
 	pthread_mutex_lock(&mutex);
 	if (__get_size() + size > capacity) {
+		__atomic_fetch_add(&stats.failed_writes, 1, __ATOMIC_RELAXED);
 		pthread_mutex_unlock(&mutex);
 		return false;
 	}
+	int written = size;
 
 	void *q = NULL;
 	char *r = (char*)p;
@@ -218,6 +287,8 @@ bool rbuf::write(const void* p, int size)
 #endif
 	}
 	pthread_mutex_unlock(&mutex);
+	__count_in(written);
+	__notify_waiter();
 	return true;
 }
 #endif
@@ -225,6 +296,9 @@ bool rbuf::write(const void* p, int size)
 
 int rbuf::get_read_ptr(void**p, int size)
 {
+	if (spsc)
+		return spsc_get_read_ptr(p, size);
+
 	pthread_mutex_lock(&mutex);
 
 	return __get_read_ptr(p, size);
@@ -232,24 +306,160 @@ int rbuf::get_read_ptr(void**p, int size)
 
 void rbuf::put_read_ptr(int size)
 {
-	__put_read_ptr(size);
+	if (size > 0)
+		__atomic_fetch_add(&stats.bytes_out, size, __ATOMIC_RELAXED);
 
-	pthread_mutex_unlock(&mutex);
+	if (spsc)
+		spsc_put_read_ptr(size);
+	else {
+		__put_read_ptr(size);
+
+		pthread_mutex_unlock(&mutex);
+	}
+	__notify_writer();
 }
 
 int rbuf::read(void* p, int size)
 {
 	void *q = NULL;
-	int newsize = get_read_ptr(&q, size);
+	char *r = (char*)p;
+	int newsize, total = 0;
+
+	/* a second pass picks up whatever wrapped around to the start */
+	do {
+		newsize = get_read_ptr(&q, size - total);
+
+		/*  newsize will never be < 0, but this should satisfy the coverity checker */
+		if (newsize > 0)
+			memcpy(r + total, q, newsize);
+
+		put_read_ptr(newsize);
+		total += (newsize > 0) ? newsize : 0;
+	} while ((newsize > 0) && (total < size));
+
+	return total;
+}
+
+
+static uint64_t elapsed_usec(struct timeval *since)
+{
+	struct timeval now;
 
-	/*  newsize will never be < 0, but this should satisfy the coverity checker */
-	if (newsize > 0)
-		memcpy(p, q, newsize);
+	gettimeofday(&now, NULL);
 
-	put_read_ptr(newsize);
-	return newsize;
+	return (uint64_t)(now.tv_sec - since->tv_sec) * 1000000 + (now.tv_usec - since->tv_usec);
 }
 
+bool rbuf::wait_for_size(int size, int timeout_ms)
+{
+	if (get_size() >= size)
+		return true;
+
+	struct timeval now;
+	struct timespec abstime;
+
+	gettimeofday(&now, NULL);
+	abstime.tv_sec  = now.tv_sec + timeout_ms / 1000;
+	abstime.tv_nsec = (now.tv_usec + (timeout_ms % 1000) * 1000) * 1000;
+	if (abstime.tv_nsec >= 1000000000) {
+		abstime.tv_sec++;
+		abstime.tv_nsec -= 1000000000;
+	}
+
+	pthread_mutex_lock(&wait_mutex);
+
+	__atomic_store_n(&wait_threshold, size, __ATOMIC_RELAXED);
+	__atomic_store_n(&waiting, 1, __ATOMIC_SEQ_CST);
+
+	/* re-check now that the producer is able to see us waiting.
+	 * a spurious wakeup simply returns false, the caller loops anyway */
+	if (get_size() < size)
+		pthread_cond_timedwait(&wait_cond, &wait_mutex, &abstime);
+
+	__atomic_store_n(&waiting, 0, __ATOMIC_SEQ_CST);
+
+	pthread_mutex_unlock(&wait_mutex);
+
+	__atomic_fetch_add(&stats.wait_usec, elapsed_usec(&now), __ATOMIC_RELAXED);
+
+	return (get_size() >= size);
+}
+
+bool rbuf::wait_for_space(int size, int timeout_ms)
+{
+	if (capacity - get_size() >= size)
+		return true;
+
+	struct timeval now;
+	struct timespec abstime;
+
+	gettimeofday(&now, NULL);
+	abstime.tv_sec  = now.tv_sec + timeout_ms / 1000;
+	abstime.tv_nsec = (now.tv_usec + (timeout_ms % 1000) * 1000) * 1000;
+	if (abstime.tv_nsec >= 1000000000) {
+		abstime.tv_sec++;
+		abstime.tv_nsec -= 1000000000;
+	}
+
+	pthread_mutex_lock(&wait_mutex);
+
+	__atomic_store_n(&space_threshold, size, __ATOMIC_RELAXED);
+	__atomic_store_n(&waiting_space, 1, __ATOMIC_SEQ_CST);
+
+	if (capacity - get_size() < size)
+		pthread_cond_timedwait(&wait_cond, &wait_mutex, &abstime);
+
+	__atomic_store_n(&waiting_space, 0, __ATOMIC_SEQ_CST);
+
+	pthread_mutex_unlock(&wait_mutex);
+
+	return (capacity - get_size() >= size);
+}
+
+void rbuf::notify()
+{
+	pthread_mutex_lock(&wait_mutex);
+	pthread_cond_broadcast(&wait_cond);
+	pthread_mutex_unlock(&wait_mutex);
+}
+
+void rbuf::get_stats(rbuf_stats_t *s)
+{
+	rbuf_stats_load(s, &stats);
+	s->capacity = capacity;
+	s->fill = (capacity) ? get_size() : 0;
+}
+
+/* producer side only */
+void rbuf::__count_in(int size)
+{
+	if (size <= 0)
+		return;
+
+	__atomic_fetch_add(&stats.bytes_in, size, __ATOMIC_RELAXED);
+
+	rbuf_stats_peak(&stats.peak_fill, get_size());
+}
+
+void rbuf::__notify_writer()
+{
+	/* pairs with the store to 'waiting_space' in wait_for_space() */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	if ((__atomic_load_n(&waiting_space, __ATOMIC_RELAXED)) &&
+	    (capacity - get_size() >= __atomic_load_n(&space_threshold, __ATOMIC_RELAXED)))
+		notify();
+}
+
+void rbuf::__notify_waiter()
+{
+	/* pairs with the store to 'waiting' in wait_for_size() */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	if ((__atomic_load_n(&waiting, __ATOMIC_RELAXED)) &&
+	    (get_size() >= __atomic_load_n(&wait_threshold, __ATOMIC_RELAXED)))
+		notify();
+}
 
 int rbuf::__get_size()
 {
@@ -261,9 +471,62 @@ int rbuf::__get_size()
 	return ret;
 }
 
+/* map the same pages twice, back to back, so that anything up to the
+ * capacity can be read or written in one contiguous span.  cap must be
+ * a multiple of the page size.  returns NULL if this is unavailable */
+static char *mirror_alloc(int cap)
+{
+#ifdef SYS_memfd_create
+	char *base = NULL;
+	int fd = syscall(SYS_memfd_create, "rbuf", 0);
+
+	if ((fd >= 0) && (0 == ftruncate(fd, cap)))
+		base = (char*)mmap(NULL, 2 * cap, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if ((base) && (base != MAP_FAILED) &&
+	    (MAP_FAILED != mmap(base,       cap, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0)) &&
+	    (MAP_FAILED != mmap(base + cap, cap, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0))) {
+		close(fd);
+		return base;
+	}
+	perror("rbuf mirror mapping failed");
+
+	if ((base) && (base != MAP_FAILED))
+		munmap(base, 2 * cap);
+	if (fd >= 0)
+		close(fd);
+#else
+	(void)cap;
+#endif
+	return NULL;
+}
+
+static void mirror_free(char *base, int cap)
+{
+	munmap(base, 2 * cap);
+}
+
+void rbuf::__alloc(int cap, bool mirror)
+{
+	mirrored = ((mirror) && (NULL != (p_data = mirror_alloc(cap))));
+	if (!mirrored)
+		p_data = new char[cap];
+}
+
+void rbuf::__free()
+{
+	if ((p_data) && (mirrored))
+		mirror_free(p_data, capacity);
+	else if (p_data)
+		delete[] p_data;
+	p_data = NULL;
+	mirrored = false;
+}
+
 void rbuf::__reset()
 {
 	idx_read = idx_write = 0;
+	pos_read = pos_write = 0;
 }
 
 int rbuf::__get_write_ptr(void** p)
@@ -316,3 +579,313 @@ void rbuf::__put_read_ptr(int size)
 		idx_read += size;
 	}
 }
+
+/* RBUF_SPSC: the producer only ever stores pos_write and the consumer only
+ * ever stores pos_read, so acquire / release ordering on the opposite
+ * position is all that is needed to hand off the data in between.
+ */
+
+int rbuf::spsc_get_size()
+{
+	unsigned int w = __atomic_load_n(&pos_write, __ATOMIC_ACQUIRE);
+	unsigned int r = __atomic_load_n(&pos_read,  __ATOMIC_ACQUIRE);
+
+	return (int)(w - r);
+}
+
+int rbuf::spsc_get_write_ptr(void** p)
+{
+	unsigned int r = __atomic_load_n(&pos_read, __ATOMIC_ACQUIRE);
+	unsigned int offset = pos_write & (capacity - 1);
+
+	int available = capacity - (int)(pos_write - r);
+	int contiguous = (mirrored) ? capacity : capacity - offset;
+
+	if (available > contiguous)
+		available = contiguous;
+	if (available <= 0)
+		return 0;
+
+	*p = &p_data[offset];
+
+	return available;
+}
+
+void rbuf::spsc_put_write_ptr(int size)
+{
+	if (size > 0)
+		__atomic_store_n(&pos_write, pos_write + size, __ATOMIC_RELEASE);
+}
+
+bool rbuf::spsc_write(const void* p, int size)
+{
+	unsigned int r = __atomic_load_n(&pos_read, __ATOMIC_ACQUIRE);
+
+	if ((int)(pos_write - r) + size > capacity)
+		return false;
+
+	unsigned int offset = pos_write & (capacity - 1);
+	int split = (mirrored) ? size : capacity - offset;
+
+	if (size > split) {
+		memcpy(p_data + offset, p, split);
+		memcpy(p_data, (const char*) p + split, size - split);
+	} else
+		memcpy(p_data + offset, p, size);
+
+	__atomic_store_n(&pos_write, pos_write + size, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+int rbuf::spsc_get_read_ptr(void**p, int size)
+{
+	unsigned int w = __atomic_load_n(&pos_write, __ATOMIC_ACQUIRE);
+	unsigned int offset = pos_read & (capacity - 1);
+
+	int max_size = (int)(w - pos_read);
+	int contiguous = (mirrored) ? capacity : capacity - offset;
+
+	if (max_size <= 0)
+		return 0;
+
+	if (size > max_size)
+		size = max_size;
+	if (size > contiguous)
+		size = contiguous;
+
+	*p = p_data + offset;
+
+	return size;
+}
+
+void rbuf::spsc_put_read_ptr(int size)
+{
+	if (size > 0)
+		__atomic_store_n(&pos_read, pos_read + size, __ATOMIC_RELEASE);
+}
+
+/* ----------------------------------------------------------------- */
+
+rbuf_broadcast::rbuf_broadcast()
+  : capacity(0)
+  , p_data(NULL)
+  , mirrored(false)
+  , pos_claim(0)
+  , pos_write(0)
+  , wake_pos(0)
+  , waiting(0)
+{
+	dprintf("()");
+	pthread_mutex_init(&wait_mutex, 0);
+	pthread_cond_init(&wait_cond, 0);
+}
+
+rbuf_broadcast::~rbuf_broadcast()
+{
+	dprintf("()");
+
+	dealloc();
+
+	pthread_cond_destroy(&wait_cond);
+	pthread_mutex_destroy(&wait_mutex);
+}
+
+rbuf_broadcast::rbuf_broadcast(const rbuf_broadcast&)
+{
+	dprintf("(copy)");
+	pthread_mutex_init(&wait_mutex, 0);
+	pthread_cond_init(&wait_cond, 0);
+	p_data    = NULL;
+	capacity  = 0;
+	mirrored  = false;
+	pos_claim = 0;
+	pos_write = 0;
+	wake_pos  = 0;
+	waiting   = 0;
+}
+
+rbuf_broadcast& rbuf_broadcast::operator= (const rbuf_broadcast& cSource)
+{
+	dprintf("(operator=)");
+
+	if (this == &cSource)
+		return *this;
+
+	p_data    = NULL;
+	capacity  = 0;
+	mirrored  = false;
+	pos_claim = 0;
+	pos_write = 0;
+	wake_pos  = 0;
+	waiting   = 0;
+
+	return *this;
+}
+
+void rbuf_broadcast::dealloc()
+{
+	dprintf("()");
+
+	if ((p_data) && (mirrored))
+		mirror_free(p_data, capacity);
+	else if (p_data)
+		delete[] p_data;
+	p_data = NULL;
+	mirrored = false;
+
+	capacity = 0;
+	pos_claim = pos_write = 0;
+}
+
+void rbuf_broadcast::set_capacity(int cap)
+{
+	dprintf("(%d)", cap);
+
+	dealloc();
+
+	/* whole packets, so that a reader never sees a packet split at the
+	 * wrap even if the mirror mapping is unavailable */
+	int page = sysconf(_SC_PAGESIZE);
+	int a = page, b = 188;
+	while (b) {
+		int t = a % b;
+		a = b;
+		b = t;
+	}
+	int unit = page / a * 188;
+
+	capacity = ((cap + unit - 1) / unit) * unit;
+
+	mirrored = (NULL != (p_data = mirror_alloc(capacity)));
+	if (!mirrored)
+		p_data = new char[capacity];
+}
+
+void rbuf_broadcast::write(const void* p, int size)
+{
+	if ((!p_data) || (size <= 0))
+		return;
+
+	if (size > capacity) {
+		/* only the tail would survive anyway */
+		p = (const char*)p + size - capacity;
+		size = capacity;
+	}
+
+	int offset = pos_write % capacity;
+	int split = (mirrored) ? size : capacity - offset;
+
+	__atomic_store_n(&pos_claim, pos_write + size, __ATOMIC_RELAXED);
+	/* readers must see the claim before any of the data is overwritten */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	if (size > split) {
+		memcpy(p_data + offset, p, split);
+		memcpy(p_data, (const char*) p + split, size - split);
+	} else
+		memcpy(p_data + offset, p, size);
+
+	__atomic_store_n(&pos_write, pos_write + size, __ATOMIC_RELEASE);
+
+	/* pairs with the store to 'waiting' in wait_for_size() */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	if ((__atomic_load_n(&waiting, __ATOMIC_RELAXED)) &&
+	    (pos_write >= __atomic_load_n(&wake_pos, __ATOMIC_RELAXED)))
+		notify();
+}
+
+uint64_t rbuf_broadcast::get_write_pos()
+{
+	return __atomic_load_n(&pos_write, __ATOMIC_ACQUIRE);
+}
+
+bool rbuf_broadcast::is_valid(uint64_t pos)
+{
+	/* order the reader's prior accesses to the data before the check */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	return (__atomic_load_n(&pos_claim, __ATOMIC_RELAXED) - pos <= (uint64_t)capacity);
+}
+
+int rbuf_broadcast::get_size(uint64_t pos)
+{
+	uint64_t w = get_write_pos();
+
+	if (!is_valid(pos))
+		return -1;
+
+	return (w > pos) ? (int)(w - pos) : 0;
+}
+
+int rbuf_broadcast::get_read_ptr(uint64_t pos, void** p, int size)
+{
+	int max_size = get_size(pos);
+
+	if (max_size <= 0)
+		return max_size;
+
+	int offset = pos % capacity;
+	int contiguous = (mirrored) ? capacity : capacity - offset;
+
+	if (size > max_size)
+		size = max_size;
+	if (size > contiguous)
+		size = contiguous;
+
+	*p = p_data + offset;
+
+	return size;
+}
+
+bool rbuf_broadcast::wait_for_size(uint64_t pos, int size, int timeout_ms, rbuf_stats_t *stats)
+{
+	int available = get_size(pos);
+
+	/* an overrun reader has to resync right away */
+	if ((available < 0) || (available >= size))
+		return true;
+
+	struct timeval now;
+	struct timespec abstime;
+
+	gettimeofday(&now, NULL);
+	abstime.tv_sec  = now.tv_sec + timeout_ms / 1000;
+	abstime.tv_nsec = (now.tv_usec + (timeout_ms % 1000) * 1000) * 1000;
+	if (abstime.tv_nsec >= 1000000000) {
+		abstime.tv_sec++;
+		abstime.tv_nsec -= 1000000000;
+	}
+
+	pthread_mutex_lock(&wait_mutex);
+
+	/* the writer wakes everybody as soon as the nearest target is reached */
+	if ((!waiting) || (pos + size < wake_pos))
+		__atomic_store_n(&wake_pos, pos + size, __ATOMIC_RELAXED);
+	__atomic_store_n(&waiting, waiting + 1, __ATOMIC_SEQ_CST);
+
+	available = get_size(pos);
+	if ((available >= 0) && (available < size))
+		pthread_cond_timedwait(&wait_cond, &wait_mutex, &abstime);
+
+	__atomic_store_n(&waiting, waiting - 1, __ATOMIC_SEQ_CST);
+
+	pthread_mutex_unlock(&wait_mutex);
+
+	if (stats)
+		__atomic_fetch_add(&stats->wait_usec, elapsed_usec(&now), __ATOMIC_RELAXED);
+
+	available = get_size(pos);
+
+	return ((available < 0) || (available >= size));
+}
+
+void rbuf_broadcast::notify()
+{
+	pthread_mutex_lock(&wait_mutex);
+	/* everybody wakes up, those still short of data register again */
+	__atomic_store_n(&wake_pos, (uint64_t) - 1, __ATOMIC_RELAXED);
+	pthread_cond_broadcast(&wait_cond);
+	pthread_mutex_unlock(&wait_mutex);
+}
@@ -23,8 +23,50 @@
 #define __RBUF_H__
 
 #include <pthread.h>
+#include <stdint.h>
 #include <string.h>
 
+enum rbuf_options {
+	RBUF_LOCKED   = 0,
+	RBUF_SPSC     = 1, /* lockless, single producer / single consumer only */
+	RBUF_MIRRORED = 3, /* RBUF_SPSC, mapped twice back to back so that spans never split */
+};
+
+/* counters are cumulative since the last set_capacity() */
+typedef struct
+{
+	uint64_t bytes_in;
+	uint64_t bytes_out;
+	uint64_t bytes_dropped;
+	unsigned long int failed_writes;	/* write() calls refused for lack of space */
+	uint64_t wait_usec;			/* time the consumer spent blocked in wait_for_size() */
+	int capacity;
+	int fill;
+	int peak_fill;
+} rbuf_stats_t;
+
+/* the counters are updated by the producer, the consumer and whoever drops
+ * data while another thread reads them, so each goes through __atomic */
+static inline void rbuf_stats_peak(int *peak, int fill)
+{
+	int cur = __atomic_load_n(peak, __ATOMIC_RELAXED);
+	while ((fill > cur) &&
+	       (!__atomic_compare_exchange_n(peak, &cur, fill, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)))
+		;
+}
+
+static inline void rbuf_stats_load(rbuf_stats_t *dst, rbuf_stats_t *src)
+{
+	dst->bytes_in      = __atomic_load_n(&src->bytes_in, __ATOMIC_RELAXED);
+	dst->bytes_out     = __atomic_load_n(&src->bytes_out, __ATOMIC_RELAXED);
+	dst->bytes_dropped = __atomic_load_n(&src->bytes_dropped, __ATOMIC_RELAXED);
+	dst->failed_writes = __atomic_load_n(&src->failed_writes, __ATOMIC_RELAXED);
+	dst->wait_usec     = __atomic_load_n(&src->wait_usec, __ATOMIC_RELAXED);
+	dst->capacity      = __atomic_load_n(&src->capacity, __ATOMIC_RELAXED);
+	dst->fill          = __atomic_load_n(&src->fill, __ATOMIC_RELAXED);
+	dst->peak_fill     = __atomic_load_n(&src->peak_fill, __ATOMIC_RELAXED);
+}
+
 class rbuf {
 public:
     rbuf();
@@ -33,7 +75,9 @@ public:
     rbuf(const rbuf&);
     rbuf& operator= (const rbuf&);
 
-    void set_capacity(int);
+    /* RBUF_SPSC rounds the capacity up to the next power of two,
+     * RBUF_MIRRORED additionally up to a whole number of pages */
+    void set_capacity(int, enum rbuf_options opt = RBUF_LOCKED);
     int  get_capacity();
     int  get_size();
     void dealloc();
@@ -49,6 +93,19 @@ public:
     void put_read_ptr(int);
     int  read(void*, int);
 
+    /* block the consumer until at least size bytes are buffered, the
+     * timeout expires or notify() is called.  returns true if size
+     * bytes are available */
+    bool wait_for_size(int size, int timeout_ms);
+    /* the same for a producer that would rather wait than drop data,
+     * returns true once size bytes are free */
+    bool wait_for_space(int size, int timeout_ms);
+    void notify();
+
+    void get_stats(rbuf_stats_t*);
+    /* for producers that give up on data after a failed write() */
+    void count_dropped(int size) { __atomic_fetch_add(&stats.bytes_dropped, size, __ATOMIC_RELAXED); }
+
 private:
     pthread_mutex_t mutex;
 
@@ -58,14 +115,93 @@ private:
     int idx_read;
     int idx_write;
 
+    /* RBUF_SPSC: free-running positions, masked by (capacity - 1) */
+    bool spsc;
+    bool mirrored;
+    unsigned int pos_read;
+    unsigned int pos_write;
+
+    pthread_mutex_t wait_mutex;
+    pthread_cond_t  wait_cond;
+    int wait_threshold;
+    int waiting;
+    int space_threshold;
+    int waiting_space;
+
+    rbuf_stats_t stats;
+
     int  __get_size();
     void __reset();
 
+    void __alloc(int, bool);
+    void __free();
+
+    void __notify_waiter();
+    void __notify_writer();
+    void __count_in(int);
+
     int  __get_write_ptr(void**);
     void __put_write_ptr(int);
 
     int  __get_read_ptr(void**, int);
     void __put_read_ptr(int);
+
+    int  spsc_get_size();
+
+    int  spsc_get_write_ptr(void**);
+    void spsc_put_write_ptr(int);
+    bool spsc_write(const void*, int);
+
+    int  spsc_get_read_ptr(void**, int);
+    void spsc_put_read_ptr(int);
+};
+
+/* single writer, many readers.  the writer never blocks: each reader keeps
+ * its own position and a reader that falls more than one capacity behind
+ * is detected by its position and has to resync to get_write_pos() */
+class rbuf_broadcast {
+public:
+    rbuf_broadcast();
+    ~rbuf_broadcast();
+
+    rbuf_broadcast(const rbuf_broadcast&);
+    rbuf_broadcast& operator= (const rbuf_broadcast&);
+
+    /* rounded up to a whole number of both pages and 188 byte packets */
+    void set_capacity(int);
+    int  get_capacity() { return capacity; }
+    void dealloc();
+
+    void write(const void*, int);
+
+    uint64_t get_write_pos();
+
+    /* both return -1 once the reader at pos has been overrun */
+    int  get_size(uint64_t pos);
+    int  get_read_ptr(uint64_t pos, void**, int);
+
+    /* true while the data from pos onwards has not been overwritten,
+     * check this after using the pointer returned by get_read_ptr() */
+    bool is_valid(uint64_t pos);
+
+    /* stats, if given, accumulates the time spent blocked */
+    bool wait_for_size(uint64_t pos, int size, int timeout_ms, rbuf_stats_t *stats = NULL);
+    void notify();
+
+private:
+    int capacity;
+    char* p_data;
+    bool mirrored;
+
+    /* the writer claims a span before copying into it, and publishes
+     * it once the copy is complete */
+    uint64_t pos_claim;
+    uint64_t pos_write;
+
+    pthread_mutex_t wait_mutex;
+    pthread_cond_t  wait_cond;
+    uint64_t wake_pos;
+    int waiting;
 };
 
 #endif /* __RBUF_H__ */
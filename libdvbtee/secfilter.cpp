@@ -0,0 +1,302 @@
+/*****************************************************************************
+ * Copyright (C) 2011-2015 Michael Ira Krufky
+ *
+ * Author: Michael Ira Krufky <mkrufky@linuxtv.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+#include <pthread.h>
+#include <string.h>
+
+#include "secfilter.h"
+
+/* slicing-by-8, crc_table[k][i] is the CRC of byte i followed by k zeroes */
+static uint32_t crc_table[8][256];
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
+
+static void crc_table_init()
+{
+	for (int i = 0; i < 256; i++) {
+		uint32_t crc = (uint32_t)i << 24;
+		for (int j = 0; j < 8; j++)
+			crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : (crc << 1);
+		crc_table[0][i] = crc;
+	}
+	for (int k = 1; k < 8; k++)
+		for (int i = 0; i < 256; i++)
+			crc_table[k][i] = (crc_table[k - 1][i] << 8) ^ crc_table[0][crc_table[k - 1][i] >> 24];
+}
+
+uint32_t section_crc32(const uint8_t *p, int size, uint32_t crc)
+{
+	pthread_once(&crc_table_once, crc_table_init);
+
+	for (; size >= 8; size -= 8, p += 8) {
+		uint32_t a = crc ^ (((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]);
+		crc = crc_table[7][a >> 24] ^ crc_table[6][(a >> 16) & 0xff] ^
+		      crc_table[5][(a >> 8) & 0xff] ^ crc_table[4][a & 0xff] ^
+		      crc_table[3][p[4]] ^ crc_table[2][p[5]] ^
+		      crc_table[1][p[6]] ^ crc_table[0][p[7]];
+	}
+	for (; size > 0; size--, p++)
+		crc = (crc << 8) ^ crc_table[0][(crc >> 24) ^ *p];
+
+	return crc;
+}
+
+void section_packetize(const uint8_t *section, int size, uint16_t pid, uint8_t *cc, section_filter_callback cb, void *priv)
+{
+	uint8_t pkt[188];
+	int offset = 0;
+
+	while (offset < size) {
+		/* the first packet starts with a zero pointer field */
+		int start = (offset) ? 4 : 5;
+		int n = size - offset;
+		if (n > 188 - start)
+			n = 188 - start;
+
+		*cc = (*cc + 1) & 0x0f;
+
+		pkt[0] = 0x47;
+		pkt[1] = ((offset) ? 0x00 : 0x40) | ((pid >> 8) & 0x1f);
+		pkt[2] = pid & 0xff;
+		pkt[3] = 0x10 | *cc;
+		pkt[4] = 0;
+		memcpy(&pkt[start], &section[offset], n);
+		memset(&pkt[start + n], 0xff, 188 - start - n);
+
+		cb(priv, pkt);
+		offset += n;
+	}
+}
+
+section_filter::section_filter()
+  : pid(0)
+  , cc(-1)
+  , out_cc(0)
+  , section_len(0)
+  , section_size(0)
+  , skipped(0)
+  , crc_errors(0)
+  , pkt_cb(NULL)
+  , sec_cb(NULL)
+  , cb_priv(NULL)
+{
+	memset(seen, 0, sizeof(seen));
+}
+
+section_filter::~section_filter()
+{
+}
+
+section_filter::section_filter(const section_filter&)
+{
+	pid = 0;
+	cc = -1;
+	out_cc = 0;
+	section_len = 0;
+	section_size = 0;
+	memset(seen, 0, sizeof(seen));
+	skipped = 0;
+	crc_errors = 0;
+	pkt_cb = NULL;
+	sec_cb = NULL;
+	cb_priv = NULL;
+}
+
+section_filter& section_filter::operator= (const section_filter& cSource)
+{
+	if (this == &cSource)
+		return *this;
+
+	pid = 0;
+	cc = -1;
+	out_cc = 0;
+	section_len = 0;
+	section_size = 0;
+	memset(seen, 0, sizeof(seen));
+	skipped = 0;
+	crc_errors = 0;
+	pkt_cb = NULL;
+	sec_cb = NULL;
+	cb_priv = NULL;
+
+	return *this;
+}
+
+void section_filter::reset()
+{
+	/* cc and out_cc stay, the receiving end keeps counting */
+	section_len = 0;
+	section_size = 0;
+	memset(seen, 0, sizeof(seen));
+}
+
+void section_filter::push(const uint8_t *p, section_filter_callback cb, void *priv)
+{
+	pkt_cb = cb;
+	sec_cb = NULL;
+	cb_priv = priv;
+	__push(p);
+}
+
+void section_filter::push(const uint8_t *p, section_callback cb, void *priv)
+{
+	pkt_cb = NULL;
+	sec_cb = cb;
+	cb_priv = priv;
+	__push(p);
+}
+
+void section_filter::__push(const uint8_t *p)
+{
+	uint8_t adaptation_flags = (p[3] & 0x30) >> 4;
+	int cur = p[3] & 0x0f;
+	int offset = 4;
+
+	if (!(adaptation_flags & 0x01))
+		return;
+	if (adaptation_flags & 0x02)
+		offset += 1 + p[4];
+	if (offset >= 188)
+		return;
+
+	if (cc < 0) {
+		pid = ((p[1] & 0x1f) << 8) | p[2];
+		/* the receiving end last saw the packet before this one */
+		out_cc = (cur - 1) & 0x0f;
+	} else if (cur == cc)
+		return; /* duplicate */
+	else if (cur != ((cc + 1) & 0x0f))
+		section_len = section_size = 0;
+	cc = cur;
+
+	const uint8_t *q = p + offset;
+	int size = 188 - offset;
+
+	if (!(p[1] & 0x40)) {
+		if (section_len)
+			append(q, size);
+		return;
+	}
+
+	int pointer = q[0];
+	q++;
+	size--;
+	if (pointer > size) {
+		section_len = section_size = 0;
+		return;
+	}
+
+	/* the tail of the previous section, if we have the rest of it */
+	if (section_len) {
+		append(q, pointer);
+		section_len = section_size = 0;
+	}
+	q += pointer;
+	size -= pointer;
+
+	while ((size > 0) && (q[0] != 0xff)) {
+		int used = append(q, size);
+		q += used;
+		size -= used;
+		if (section_len)
+			break; /* continues in the next packet */
+	}
+}
+
+int section_filter::append(const uint8_t *p, int size)
+{
+	int used = 0;
+
+	/* the length is in the 3 byte header */
+	while ((!section_size) && (used < size)) {
+		section[section_len++] = p[used++];
+		if (section_len == 3) {
+			section_size = 3 + (((section[1] & 0x0f) << 8) | section[2]);
+			if (section_size > SECTION_MAX_SIZE) {
+				section_len = section_size = 0;
+				return size;
+			}
+		}
+	}
+	if (!section_size)
+		return used;
+
+	int n = section_size - section_len;
+	if (n > size - used)
+		n = size - used;
+	memcpy(&section[section_len], &p[used], n);
+	section_len += n;
+	used += n;
+
+	if (section_len == section_size) {
+		complete();
+		section_len = section_size = 0;
+	}
+	return used;
+}
+
+bool section_filter::is_seen(uint32_t key, uint32_t crc)
+{
+	unsigned int idx = ((key * 2654435761U) >> 16) % SECTION_FILTER_SLOTS;
+
+	for (int i = 0; i < SECTION_FILTER_SLOTS; i++, idx = (idx + 1) % SECTION_FILTER_SLOTS) {
+		if (!seen[idx].used) {
+			seen[idx].used = true;
+			seen[idx].key = key;
+			seen[idx].crc = crc;
+			return false;
+		}
+		if (seen[idx].key == key) {
+			if (seen[idx].crc == crc)
+				return true;
+			seen[idx].crc = crc;
+			return false;
+		}
+	}
+	return false;
+}
+
+void section_filter::complete()
+{
+	/* long form: 8 byte header and a trailing CRC */
+	if ((section[1] & 0x80) && (section_size >= 12)) {
+		if (section_crc32(section, section_size)) {
+			crc_errors++;
+			return;
+		}
+		if (sec_cb) {
+			sec_cb(cb_priv, section, section_size);
+			return;
+		}
+
+		uint32_t key = (section[0] << 24) | (section[3] << 16) | (section[4] << 8) | section[6];
+		const uint8_t *c = &section[section_size - 4];
+		uint32_t crc = (c[0] << 24) | (c[1] << 16) | (c[2] << 8) | c[3];
+
+		if (is_seen(key, crc)) {
+			skipped++;
+			return;
+		}
+	} else if (sec_cb) {
+		sec_cb(cb_priv, section, section_size);
+		return;
+	}
+	section_packetize(section, section_size, pid, &out_cc, pkt_cb, cb_priv);
+}
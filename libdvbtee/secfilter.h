@@ -0,0 +1,97 @@
+/*****************************************************************************
+ * Copyright (C) 2011-2015 Michael Ira Krufky
+ *
+ * Author: Michael Ira Krufky <mkrufky@linuxtv.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+#ifndef __SECFILTER_H__
+#define __SECFILTER_H__
+
+#include <stdint.h>
+
+/* a private section, header included, is at most 4096 bytes */
+#define SECTION_MAX_SIZE 4096
+/* distinct sections remembered per pid, the rest are always passed on */
+#define SECTION_FILTER_SLOTS 256
+
+/* CRC-32/MPEG-2 over size bytes.  0 over a whole section if its CRC holds */
+uint32_t section_crc32(const uint8_t *p, int size, uint32_t crc = 0xffffffff);
+
+typedef void (*section_filter_callback)(void *priv, const uint8_t *p);
+typedef void (*section_callback)(void *priv, const uint8_t *section, int size);
+
+/* the TS packets carrying a whole section on pid, a zero pointer field
+ * in the first.  *cc is the continuity counter of the last packet sent */
+void section_packetize(const uint8_t *section, int size, uint16_t pid, uint8_t *cc, section_filter_callback cb, void *priv);
+
+/* reassembles the PSI sections carried on one pid and passes on only
+ * those that differ from the last section seen with the same table id,
+ * extension and section number, each as a fresh run of TS packets.
+ * sections that fail their CRC are dropped, the CRC of the others
+ * stands in for their content.  nothing is allocated after construction */
+class section_filter
+{
+public:
+	section_filter();
+	~section_filter();
+
+	section_filter(const section_filter&);
+	section_filter& operator= (const section_filter&);
+
+	/* cb sees the packets of every new section, with a continuity
+	 * counter that carries on from the packets pushed so far */
+	void push(const uint8_t *p, section_filter_callback cb, void *priv);
+	/* cb sees every section whole, repeats included, once its CRC holds */
+	void push(const uint8_t *p, section_callback cb, void *priv);
+
+	/* forget the sections seen so far, so that all are passed on again */
+	void reset();
+
+	unsigned int get_skipped_count() { return skipped; }
+	unsigned int get_crc_error_count() { return crc_errors; }
+private:
+	uint16_t pid;
+	int cc;		/* -1 until the first packet */
+	uint8_t out_cc;
+
+	uint8_t section[SECTION_MAX_SIZE];
+	int section_len;
+	int section_size;	/* 0 until the header is in */
+
+	/* open addressed, by table id, extension & section number */
+	struct {
+		uint32_t key;
+		uint32_t crc;
+		bool used;
+	} seen[SECTION_FILTER_SLOTS];
+	unsigned int skipped;
+	unsigned int crc_errors;
+
+	/* whichever of these the current push() was given */
+	section_filter_callback pkt_cb;
+	section_callback sec_cb;
+	void *cb_priv;
+
+	bool is_seen(uint32_t key, uint32_t crc);
+
+	void __push(const uint8_t *p);
+	int  append(const uint8_t *p, int size);
+	void complete();
+};
+
+#endif /* __SECFILTER_H__ */
@@ -0,0 +1,131 @@
+/*****************************************************************************
+ * Copyright (C) 2011-2015 Michael Ira Krufky
+ *
+ * Author: Michael Ira Krufky <mkrufky@linuxtv.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include <pthread.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+/* an immutable T, replaced as a whole.  readers never block: they pin the
+ * current copy between read_lock() and read_unlock() and must not keep it
+ * past that.  writers serialize on lock() and publish a fresh copy without
+ * waiting, the one it replaced is deleted later, once no reader can still
+ * hold it.
+ *
+ * readers count themselves in one of two counters chosen by the epoch.
+ * the epoch only moves on while the counter it moves to is idle, so that
+ * a retired copy is safe once it has moved on twice: both counters have
+ * drained since, and new readers never hold the writer up */
+template <typename T>
+class snapshot
+{
+public:
+	snapshot() : current(new T), epoch(0) { readers[0] = readers[1] = 0; pthread_mutex_init(&mutex, 0); }
+	~snapshot()
+	{
+		for (unsigned int i = 0; i < retired.size(); i++)
+			delete retired[i].first;
+		delete current;
+		pthread_mutex_destroy(&mutex);
+	}
+
+	/* copies start out empty, as do the other classes here */
+	snapshot(const snapshot&) : current(new T), epoch(0) { readers[0] = readers[1] = 0; pthread_mutex_init(&mutex, 0); }
+	snapshot& operator= (const snapshot &cSource)
+	{
+		if (this != &cSource) {
+			lock();
+			publish(new T);
+			synchronize();
+			unlock();
+		}
+		return *this;
+	}
+
+	const T *read_lock(unsigned int *idx)
+	{
+		*idx = __atomic_load_n(&epoch, __ATOMIC_ACQUIRE) & 1;
+		__atomic_fetch_add(&readers[*idx], 1, __ATOMIC_SEQ_CST);
+		return __atomic_load_n(&current, __ATOMIC_SEQ_CST);
+	}
+	void read_unlock(unsigned int idx)
+	{
+		__atomic_fetch_sub(&readers[idx], 1, __ATOMIC_RELEASE);
+	}
+
+	/* writers hold the lock around get() and publish() */
+	void lock() { pthread_mutex_lock(&mutex); }
+	void unlock() { pthread_mutex_unlock(&mutex); }
+
+	const T *get() { return current; }
+
+	/* t is ours from here on.  never waits, the copy it replaces goes
+	 * with this or a later publish() or reclaim() */
+	void publish(T *t)
+	{
+		T *old = current;
+
+		__atomic_store_n(&current, t, __ATOMIC_SEQ_CST);
+		retired.push_back(std::make_pair(old, __atomic_load_n(&epoch, __ATOMIC_SEQ_CST)));
+		reclaim();
+	}
+
+	/* deletes the retired copies no reader can hold any more, without
+	 * waiting.  true once none are left */
+	bool reclaim()
+	{
+		for (int i = 0; (i < 2) && (retired.size()); i++) {
+			unsigned int e = __atomic_load_n(&epoch, __ATOMIC_SEQ_CST);
+			if (__atomic_load_n(&readers[(e + 1) & 1], __ATOMIC_SEQ_CST))
+				break;
+			__atomic_store_n(&epoch, e + 1, __ATOMIC_SEQ_CST);
+		}
+
+		unsigned int n = 0;
+		while ((n < retired.size()) && (epoch - retired[n].second >= 2))
+			delete retired[n++].first;
+		retired.erase(retired.begin(), retired.begin() + n);
+
+		return retired.empty();
+	}
+
+	/* waits until no reader can hold a copy older than the current one,
+	 * for control paths about to free what those copies point to */
+	void synchronize()
+	{
+		while (!reclaim())
+			usleep(100);
+	}
+private:
+	T *current;
+	unsigned int epoch;
+	unsigned int readers[2];
+
+	/* replaced copies, with the epoch they were replaced in */
+	std::vector<std::pair<T*, unsigned int> > retired;
+
+	pthread_mutex_t mutex;
+};
+
+#endif /* __SNAPSHOT_H__ */
@@ -0,0 +1,406 @@
+/*****************************************************************************
+ * Copyright (C) 2011-2015 Michael Ira Krufky
+ *
+ * Author: Michael Ira Krufky <mkrufky@linuxtv.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+#include <string.h>
+
+#include "splitter.h"
+#include "log.h"
+#define CLASS_MODULE "split"
+
+#define dprintf(fmt, arg...) __dprintf(DBG_OUTPUT, fmt, ##arg)
+
+#define PID_PAT 0x0000
+#define PID_SDT 0x0011
+
+splitter::splitter()
+  : num_services(0)
+  , pmt_pid(0)
+  , pending(NULL)
+  , pending_size(0)
+  , pending_mask(0)
+{
+	dprintf("()");
+	memset(pid_index, 0, sizeof(pid_index));
+	memset(pmt_pids, 0, sizeof(pmt_pids));
+}
+
+splitter::~splitter()
+{
+	dprintf("()");
+
+	stop();
+}
+
+int splitter::find(uint16_t service_id)
+{
+	for (int slot = 0; slot < num_services; slot++)
+		if (services[slot].service_id == service_id)
+			return slot;
+	return -1;
+}
+
+int splitter::__add(uint16_t service_id)
+{
+	if (find(service_id) >= 0) {
+		dprintf("service %d already added", service_id);
+		return -1;
+	}
+	if (num_services == SPLITTER_MAX_SERVICES) {
+		dprintf("no room for service %d", service_id);
+		return -1;
+	}
+	int slot = num_services;
+
+	services[slot].service_id = service_id;
+	services[slot].pmt_pid = 0;
+	services[slot].pmt_crc = 0;
+	services[slot].have_pmt = false;
+	services[slot].pat_cc = 0x0f;
+	services[slot].pmt_cc = 0x0f;
+	services[slot].sdt_cc = 0x0f;
+
+	return slot;
+}
+
+int splitter::add(uint16_t service_id, char *target)
+{
+	map_pidtype pids;
+	int slot = __add(service_id);
+
+	dprintf("(%d->%s)", service_id, target);
+
+	if (slot < 0)
+		return slot;
+
+	int ret = services[slot].stream.add(target, pids);
+	if (ret < 0)
+		return ret;
+
+	return num_services++;
+}
+
+int splitter::add(uint16_t service_id, int socket, unsigned int method)
+{
+	map_pidtype pids;
+	int slot = __add(service_id);
+
+	dprintf("(%d->%d)", service_id, socket);
+
+	if (slot < 0)
+		return slot;
+
+	int ret = services[slot].stream.add(socket, method, pids);
+	if (ret < 0)
+		return ret;
+
+	return num_services++;
+}
+
+int splitter::add(uint16_t service_id, void *priv, stream_callback cb)
+{
+	map_pidtype pids;
+	int slot = __add(service_id);
+
+	dprintf("(%d->func)", service_id);
+
+	if (slot < 0)
+		return slot;
+
+	int ret = services[slot].stream.add(priv, cb, pids);
+	if (ret < 0)
+		return ret;
+
+	return num_services++;
+}
+
+int splitter::start()
+{
+	dprintf("(%d services)", num_services);
+
+	for (int slot = 0; slot < num_services; slot++) {
+		int ret = services[slot].stream.start();
+		if (ret != 0)
+			return ret;
+	}
+	return 0;
+}
+
+void splitter::stop()
+{
+	dprintf("()");
+
+	for (int slot = 0; slot < num_services; slot++)
+		services[slot].stream.stop_without_wait();
+	for (int slot = 0; slot < num_services; slot++)
+		services[slot].stream.stop();
+}
+
+output_stream *splitter::get_stream(uint16_t service_id)
+{
+	int slot = find(service_id);
+
+	return (slot < 0) ? NULL : &services[slot].stream;
+}
+
+void splitter::flush()
+{
+	uint64_t mask = pending_mask;
+
+	while (mask) {
+		int slot = __builtin_ctzll(mask);
+		mask &= mask - 1;
+		services[slot].stream.push((uint8_t*)pending, pending_size);
+	}
+	pending = NULL;
+	pending_size = 0;
+	pending_mask = 0;
+}
+
+void splitter::push(const uint8_t *p, int size)
+{
+	for (; size >= 188; p += 188, size -= 188) {
+		/* no sync, or TEI */
+		if ((p[0] != 0x47) || (p[1] & 0x80))
+			continue;
+
+		uint16_t pid = ((p[1] & 0x1f) << 8) | p[2];
+		uint64_t mask = pid_index[pid];
+
+		if (mask) {
+			if ((mask != pending_mask) || (p != pending + pending_size)) {
+				flush();
+				pending = p;
+				pending_mask = mask;
+			}
+			pending_size += 188;
+			continue;
+		}
+
+		/* the PSI we regenerate, everything else is for no one */
+		if (pid == PID_PAT)
+			pat_filter.push(p, take_pat, this);
+		else if (pid == PID_SDT)
+			sdt_filter.push(p, take_sdt, this);
+		else if (is_pmt_pid(pid)) {
+			pmt_pid = pid;
+			pmt_filters[pid].push(p, take_pmt, this);
+		}
+	}
+	flush();
+}
+
+//static
+void splitter::send_pkt(void *p_stream, const uint8_t *p)
+{
+	static_cast<output_stream*>(p_stream)->push((uint8_t*)p, 188);
+}
+
+void splitter::send(int slot, const uint8_t *section, int size, uint16_t pid, uint8_t *cc)
+{
+	/* keep the packets in the order they came in */
+	flush();
+	section_packetize(section, size, pid, cc, send_pkt, &services[slot].stream);
+}
+
+void splitter::index_pmt_pids()
+{
+	memset(pmt_pids, 0, sizeof(pmt_pids));
+
+	for (int slot = 0; slot < num_services; slot++) {
+		uint16_t pid = services[slot].pmt_pid;
+		if (pid)
+			pmt_pids[pid >> 5] |= 1U << (pid & 31);
+	}
+}
+
+void splitter::unindex(int slot)
+{
+	uint64_t bit = 1ULL << slot;
+
+	for (int pid = 0; pid < 0x2000; pid++)
+		pid_index[pid] &= ~bit;
+}
+
+//static
+void splitter::take_pat(void *p_this, const uint8_t *section, int size)
+{
+	static_cast<splitter*>(p_this)->take_pat(section, size);
+}
+
+//static
+void splitter::take_pmt(void *p_this, const uint8_t *section, int size)
+{
+	static_cast<splitter*>(p_this)->take_pmt(section, size);
+}
+
+//static
+void splitter::take_sdt(void *p_this, const uint8_t *section, int size)
+{
+	static_cast<splitter*>(p_this)->take_sdt(section, size);
+}
+
+void splitter::take_pat(const uint8_t *section, int size)
+{
+	/* table id, long form, current */
+	if ((section[0] != 0x00) || (size < 12) || (!(section[5] & 0x01)))
+		return;
+
+	/* with a single section, a service missing from it is gone */
+	bool complete = (section[7] == 0);
+	bool changed = false;
+
+	for (int slot = 0; slot < num_services; slot++) {
+		struct splitter_service *svc = &services[slot];
+		uint16_t pmt = 0;
+
+		for (int i = 8; i + 4 <= size - 4; i += 4)
+			if (((section[i] << 8) | section[i + 1]) == svc->service_id) {
+				pmt = ((section[i + 2] & 0x1f) << 8) | section[i + 3];
+				break;
+			}
+
+		if ((!pmt) && (!complete))
+			continue;
+
+		if (pmt != svc->pmt_pid) {
+			dprintf("service %d: PMT pid %04x -> %04x", svc->service_id, svc->pmt_pid, pmt);
+			svc->pmt_pid = pmt;
+			svc->have_pmt = false;
+			unindex(slot);
+			changed = true;
+		}
+		if (!pmt)
+			continue;
+
+		/* the original header, with a single program */
+		uint8_t pat[16];
+
+		memcpy(pat, section, 8);
+		pat[1] = (section[1] & 0xf0);
+		pat[2] = 13;
+		pat[6] = pat[7] = 0;
+		pat[8] = svc->service_id >> 8;
+		pat[9] = svc->service_id & 0xff;
+		pat[10] = 0xe0 | (pmt >> 8);
+		pat[11] = pmt & 0xff;
+
+		uint32_t crc = section_crc32(pat, 12);
+		pat[12] = crc >> 24;
+		pat[13] = crc >> 16;
+		pat[14] = crc >> 8;
+		pat[15] = crc;
+
+		send(slot, pat, sizeof(pat), PID_PAT, &svc->pat_cc);
+	}
+	if (!changed)
+		return;
+
+	index_pmt_pids();
+
+	/* a new PMT pid may be carried as another service's ES or PCR,
+	 * and an old one may be one of those.  the new ones go to the
+	 * pmt filters from now on, and every service rebuilds its index
+	 * from its next PMT */
+	for (int slot = 0; slot < num_services; slot++) {
+		if (services[slot].pmt_pid)
+			pid_index[services[slot].pmt_pid] = 0;
+		services[slot].have_pmt = false;
+	}
+}
+
+void splitter::take_pmt(const uint8_t *section, int size)
+{
+	if ((section[0] != 0x02) || (size < 16) || (!(section[5] & 0x01)))
+		return;
+
+	int slot = find((section[3] << 8) | section[4]);
+	if (slot < 0)
+		return;
+
+	struct splitter_service *svc = &services[slot];
+
+	/* another program's PMT sharing the pid */
+	if (svc->pmt_pid != pmt_pid)
+		return;
+
+	const uint8_t *c = &section[size - 4];
+	uint32_t crc = (c[0] << 24) | (c[1] << 16) | (c[2] << 8) | c[3];
+
+	if ((!svc->have_pmt) || (crc != svc->pmt_crc)) {
+		uint64_t bit = 1ULL << slot;
+		uint16_t pcr_pid = ((section[8] & 0x1f) << 8) | section[9];
+		int i = 12 + (((section[10] & 0x0f) << 8) | section[11]);
+
+		unindex(slot);
+
+		/* never the pids whose PSI we regenerate */
+		if ((pcr_pid != 0x1fff) && (pcr_pid != PID_PAT) && (pcr_pid != PID_SDT) && (!is_pmt_pid(pcr_pid)))
+			pid_index[pcr_pid] |= bit;
+
+		while (i + 5 <= size - 4) {
+			uint16_t es_pid = ((section[i + 1] & 0x1f) << 8) | section[i + 2];
+			if ((es_pid != PID_PAT) && (es_pid != PID_SDT) && (!is_pmt_pid(es_pid)))
+				pid_index[es_pid] |= bit;
+			i += 5 + (((section[i + 3] & 0x0f) << 8) | section[i + 4]);
+		}
+		dprintf("service %d: PMT version %d", svc->service_id, (section[5] >> 1) & 0x1f);
+
+		svc->pmt_crc = crc;
+		svc->have_pmt = true;
+	}
+	send(slot, section, size, svc->pmt_pid, &svc->pmt_cc);
+}
+
+void splitter::take_sdt(const uint8_t *section, int size)
+{
+	/* SDT actual only */
+	if ((section[0] != 0x42) || (size < 15) || (!(section[5] & 0x01)))
+		return;
+
+	int i = 11;
+
+	while (i + 5 <= size - 4) {
+		int len = 5 + (((section[i + 3] & 0x0f) << 8) | section[i + 4]);
+		if (i + len > size - 4)
+			break;
+
+		int slot = find((section[i] << 8) | section[i + 1]);
+		if (slot >= 0) {
+			/* the original header and this service alone */
+			int sdt_size = 11 + len + 4;
+
+			memcpy(sdt, section, 11);
+			memcpy(&sdt[11], &section[i], len);
+			sdt[1] = (section[1] & 0xf0) | (((sdt_size - 3) >> 8) & 0x0f);
+			sdt[2] = (sdt_size - 3) & 0xff;
+			sdt[6] = sdt[7] = 0;
+
+			uint32_t crc = section_crc32(sdt, sdt_size - 4);
+			sdt[sdt_size - 4] = crc >> 24;
+			sdt[sdt_size - 3] = crc >> 16;
+			sdt[sdt_size - 2] = crc >> 8;
+			sdt[sdt_size - 1] = crc;
+
+			send(slot, sdt, sdt_size, PID_SDT, &services[slot].sdt_cc);
+		}
+		i += len;
+	}
+}
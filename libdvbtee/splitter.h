@@ -0,0 +1,117 @@
+/*****************************************************************************
+ * Copyright (C) 2011-2015 Michael Ira Krufky
+ *
+ * Author: Michael Ira Krufky <mkrufky@linuxtv.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+#ifndef __SPLITTER_H__
+#define __SPLITTER_H__
+
+#include <map>
+#include <stdint.h>
+
+#include "output.h"
+#include "secfilter.h"
+
+/* a bit each in the pid index */
+#define SPLITTER_MAX_SERVICES 64
+
+/* splits a multiplex into one single program stream per service in a
+ * single pass.  each packet is looked up once in a pid -> services index
+ * and copied into the output queue of each service that carries it.
+ * every service gets a PAT listing only itself, its own PMT sections
+ * and an SDT actual describing only itself, all with continuity counters
+ * of its own.  the index follows the PAT and PMTs of the multiplex */
+class splitter
+{
+public:
+	splitter();
+	~splitter();
+
+	/* services are added before start(), a target as for output::add().
+	 * each returns the slot of the service or < 0 on failure */
+	int add(uint16_t service_id, char *target);
+	int add(uint16_t service_id, int socket, unsigned int method);
+	int add(uint16_t service_id, void *priv, stream_callback cb);
+
+	int start();
+	void stop();
+
+	/* the whole multiplex, whole packets only */
+	void push(const uint8_t *p, int size);
+
+	int get_service_count() { return num_services; }
+	/* the single program stream of a service, for its stats */
+	output_stream *get_stream(uint16_t service_id);
+private:
+	/* not copyable */
+	splitter(const splitter&);
+	splitter& operator= (const splitter&);
+
+	struct splitter_service {
+		uint16_t service_id;
+		uint16_t pmt_pid;	/* 0 until seen in the PAT */
+		uint32_t pmt_crc;	/* of the PMT the index was built from */
+		bool have_pmt;
+
+		uint8_t pat_cc;
+		uint8_t pmt_cc;
+		uint8_t sdt_cc;
+
+		output_stream stream;
+	} services[SPLITTER_MAX_SERVICES];
+	int num_services;
+
+	/* a bit per service slot, for each pid */
+	uint64_t pid_index[0x2000];
+	/* the pids that carry a PMT of one of our services */
+	uint32_t pmt_pids[0x2000 / 32];
+
+	section_filter pat_filter;
+	section_filter sdt_filter;
+	std::map<uint16_t, section_filter> pmt_filters;
+	uint16_t pmt_pid;	/* of the packet in pmt_filters */
+
+	uint8_t sdt[SECTION_MAX_SIZE];
+
+	/* consecutive packets bound for the same services, copied at once */
+	const uint8_t *pending;
+	int pending_size;
+	uint64_t pending_mask;
+	void flush();
+
+	bool is_pmt_pid(uint16_t pid) { return (pmt_pids[pid >> 5] & (1U << (pid & 31))) ? true : false; }
+
+	int __add(uint16_t service_id);
+	int find(uint16_t service_id);
+
+	void index_pmt_pids();
+	void unindex(int slot);
+
+	static void take_pat(void*, const uint8_t*, int);
+	static void take_pmt(void*, const uint8_t*, int);
+	static void take_sdt(void*, const uint8_t*, int);
+	void take_pat(const uint8_t*, int);
+	void take_pmt(const uint8_t*, int);
+	void take_sdt(const uint8_t*, int);
+
+	static void send_pkt(void*, const uint8_t*);
+	void send(int slot, const uint8_t *section, int size, uint16_t pid, uint8_t *cc);
+};
+
+#endif /* __SPLITTER_H__ */
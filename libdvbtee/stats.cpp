@@ -26,6 +26,12 @@
 #include "log.h"
 #define CLASS_MODULE "stats"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+    ((__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9)))
+#define STATS_AVX2
+#include <immintrin.h>
+#endif
+
 #define DBG 0
 
 #define dprintf(fmt, arg...) __dprintf(DBG_STATS, "(%s) "fmt, parent, ##arg)
@@ -139,65 +145,129 @@ void stats::push_pid(int c, const uint16_t pid)
 
 pkt_stats_t *stats::parse(const uint8_t *p, pkt_stats_t *pkt_stats)
 {
-	adaptation_field_t adapt;
-	pkt_hdr_t hdr;
+	if (pkt_stats) {
+		pkt_stats->sync_loss = (p[0] != 0x47) ? true : false;
+		if (!pkt_stats->sync_loss) {
+			pkt_stats->tei = (p[1] & 0x80) ? true : false;
+			pkt_stats->pid = ((p[1] & 0x1f) << 8) | p[2];
+		} else {
+			pkt_stats->tei = false;
+			pkt_stats->pid = (uint16_t) - 1;
+		}
+	}
+	return pkt_stats;
+}
 
-	return parse(p, pkt_stats, hdr, adapt);
+static void parse_hdrs_scalar(const uint8_t *p, int i, int n, pkt_hdr_batch_t *batch)
+{
+	for (p += i * 188; i < n; i++, p += 188) {
+		bool sync = (p[0] == 0x47);
+		batch->pid[i]  = (sync) ? ((p[1] & 0x1f) << 8) | p[2] : (uint16_t) - 1;
+		batch->tei[i]  = (sync) ? (p[1] & 0x80) >> 7 : 0;
+		batch->ctrl[i] = p[3];
+	}
 }
 
-pkt_stats_t *stats::parse(const uint8_t *p, pkt_stats_t *pkt_stats, pkt_hdr_t &hdr, adaptation_field_t &adapt)
+#ifdef STATS_AVX2
+/* the first four bytes of eight packets per gather */
+__attribute__((target("avx2")))
+static void parse_hdrs_avx2(const uint8_t *p, int n, pkt_hdr_batch_t *batch)
 {
-	if (pkt_stats) {
-		memset(pkt_stats, 0, sizeof(pkt_stats_t));
-
-		const uint8_t *q = p;
-
-		memset(&adapt, 0, sizeof(adapt));
-		memset(&hdr, 0, sizeof(hdr));
-
-		hdr.sync_byte          = q[0];
-		hdr.tei                = (q[1] & 0x80) >> 7;
-		hdr.payload_unit_start = (q[1] & 0x40) >> 6;
-		hdr.transport_priority = (q[1] & 0x20) >> 5;
-		hdr.pid                = ((q[1] & 0x1f) << 8) | q[2];
-		hdr.scrambling         = (q[3] & 0xc0) >> 6;
-		hdr.adaptation_flags   = (q[3] & 0x30) >> 4;
-		hdr.continuity_ctr     = (q[3] & 0x0f);
-
-		if (hdr.adaptation_flags & 0x02) {
-			q += 4;
-			adapt.field_length   = q[0];
-			adapt.discontinuity  = (q[1] & 0x80) >> 7;
-			adapt.random_access  = (q[1] & 0x40) >> 6; /* set to 1 if the PES pkt in this TS pkt starts an a/v sequence */
-			adapt.es_priority    = (q[1] & 0x20) >> 5;
-			adapt.pcr            = (q[1] & 0x10) >> 4;
-			adapt.opcr           = (q[1] & 0x08) >> 3;
-			adapt.splicing_point = (q[1] & 0x04) >> 2;
-			adapt.tp_priv_data   = (q[1] & 0x02) >> 1;
-			adapt.field_ext      = (q[1] & 0x01) >> 0;
-
-			if (adapt.pcr) {
-				memcpy(adapt.PCR, &q[2], 6);
-				q += 6;
-			}
-			if (adapt.opcr) {
-				memcpy(adapt.OPCR, &q[2], 6);
-				q += 6;
-			}
-			if (adapt.splicing_point) {
-				adapt.splicing_countdown = q[2];
-				q ++;
-			}
-		}
+	const __m256i offsets = _mm256_setr_epi32(0, 188, 2*188, 3*188, 4*188, 5*188, 6*188, 7*188);
+	const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+	const __m256i sync = _mm256_set1_epi32(0x47);
+	const __m256i lost = _mm256_set1_epi32(0xffff);
+	const __m256i byte = _mm256_set1_epi32(0xff);
+	int i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		__m256i hdr = _mm256_i32gather_epi32((const int *)(p + i * 188), offsets, 1);
+		__m256i ok  = _mm256_cmpeq_epi32(_mm256_and_si256(hdr, byte), sync);
+
+		__m256i pid = _mm256_or_si256(_mm256_and_si256(hdr, _mm256_set1_epi32(0x1f00)),
+					      _mm256_and_si256(_mm256_srli_epi32(hdr, 16), byte));
+		pid = _mm256_blendv_epi8(lost, pid, ok);
+
+		__m256i tei  = _mm256_and_si256(_mm256_srli_epi32(hdr, 15), _mm256_set1_epi32(1));
+		tei = _mm256_and_si256(tei, ok);
+		__m256i ctrl = _mm256_srli_epi32(hdr, 24);
+
+		/* 32 -> 16 bits, packing works within each 128 bit lane */
+		pid = _mm256_permute4x64_epi64(_mm256_packus_epi32(pid, pid), 0x08);
+		_mm_storeu_si128((__m128i *)&batch->pid[i], _mm256_castsi256_si128(pid));
+
+		/* 32 -> 8 bits, tei in the low half and ctrl in the high half */
+		__m256i flags = _mm256_packus_epi32(tei, ctrl);
+		flags = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(flags, flags), order);
+		__m128i lo = _mm256_castsi256_si128(flags);
+		_mm_storel_epi64((__m128i *)&batch->tei[i], lo);
+		_mm_storel_epi64((__m128i *)&batch->ctrl[i], _mm_srli_si128(lo, 8));
+	}
+	parse_hdrs_scalar(p, i, n, batch);
+}
+#endif
 
-		pkt_stats->sync_loss = (hdr.sync_byte != 0x47) ? true : false;
-		if (!pkt_stats->sync_loss) {
-			pkt_stats->tei = (hdr.tei) ? true : false;
-			pkt_stats->pid = hdr.pid;
-		} else
-			pkt_stats->pid = (uint16_t) - 1;
+typedef void (*parse_hdrs_fn)(const uint8_t *, int, pkt_hdr_batch_t *);
+
+static void parse_hdrs_generic(const uint8_t *p, int n, pkt_hdr_batch_t *batch)
+{
+	parse_hdrs_scalar(p, 0, n, batch);
+}
+
+static parse_hdrs_fn pick_parse_hdrs()
+{
+#ifdef STATS_AVX2
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return parse_hdrs_avx2;
+#endif
+	return parse_hdrs_generic;
+}
+
+int stats::parse(int c, const uint8_t *p, pkt_hdr_batch_t *batch)
+{
+	static parse_hdrs_fn fn = NULL;
+
+	/* racing callers all pick the same function */
+	parse_hdrs_fn f = __atomic_load_n(&fn, __ATOMIC_RELAXED);
+	if (!f) {
+		f = pick_parse_hdrs();
+		__atomic_store_n(&fn, f, __ATOMIC_RELAXED);
+	}
+
+	batch->count = (c < STATS_BATCH) ? ((c > 0) ? c : 0) : STATS_BATCH;
+	f(p, batch->count, batch);
+	return batch->count;
+}
+
+void stats::parse_adaptation(const uint8_t *p, adaptation_field_t &adapt)
+{
+	const uint8_t *q = p + 4;
+
+	memset(&adapt, 0, sizeof(adapt));
+
+	adapt.field_length   = q[0];
+	adapt.discontinuity  = (q[1] & 0x80) >> 7;
+	adapt.random_access  = (q[1] & 0x40) >> 6; /* set to 1 if the PES pkt in this TS pkt starts an a/v sequence */
+	adapt.es_priority    = (q[1] & 0x20) >> 5;
+	adapt.pcr            = (q[1] & 0x10) >> 4;
+	adapt.opcr           = (q[1] & 0x08) >> 3;
+	adapt.splicing_point = (q[1] & 0x04) >> 2;
+	adapt.tp_priv_data   = (q[1] & 0x02) >> 1;
+	adapt.field_ext      = (q[1] & 0x01) >> 0;
+
+	if (adapt.pcr) {
+		memcpy(adapt.PCR, &q[2], 6);
+		q += 6;
+	}
+	if (adapt.opcr) {
+		memcpy(adapt.OPCR, &q[2], 6);
+		q += 6;
+	}
+	if (adapt.splicing_point) {
+		adapt.splicing_countdown = q[2];
+		q ++;
 	}
-	return pkt_stats;
 }
 
 void stats::clear_stats()
@@ -208,71 +278,103 @@ void stats::clear_stats()
 	tei_count = 0;
 }
 
-void stats::push_stats(pkt_stats_t *pkt_stats)
+void stats::push(int c, const uint8_t *p, pkt_stats_t *pkt_stats)
 {
-	if (pkt_stats->tei) {
-		tei_count++;
-		push_pid((uint16_t) - 1);
-	} else
-		push_pid(pkt_stats->pid);
+	pkt_hdr_batch_t batch;
+
+	if (c <= 0)
+		return;
+
+	if (!pkt_stats) {
+		for (int i = 0; i < c; i++)
+			__push(p + i * 188);
+		return;
+	}
+
+	while (c > 0) {
+		int n = parse(c, p, &batch);
+
+		for (int i = 0; i < n; i++, p += 188)
+			push(p, &batch, i);
+		c -= n;
+	}
+	/* pkt_stats describes the last packet */
+	parse(p - 188, pkt_stats);
 }
 
 void stats::push(const uint8_t *p, pkt_stats_t *pkt_stats)
 {
-	adaptation_field_t adapt;
-	pkt_hdr_t hdr;
-
 	if (!pkt_stats) {
 		__push(p);
 		return;
 	}
 
-	memset(pkt_stats, 0, sizeof(pkt_stats_t));
+	parse(p, pkt_stats);
+	push(p, pkt_stats->pid, pkt_stats->tei, p[3]);
+}
 
-	parse(p, pkt_stats, hdr, adapt);
+void stats::push(const uint8_t *p, const pkt_hdr_batch_t *batch, int i)
+{
+	push(p, batch->pid[i], batch->tei[i], batch->ctrl[i]);
+}
 
-	if (hdr.adaptation_flags & 0x01) {// payload present
-		if (continuity.count(hdr.pid)) {
-			uint8_t next = (continuity[hdr.pid] + 1) & 0x0f;
-			if ((next != (hdr.continuity_ctr & 0x0f)) && (hdr.continuity_ctr + continuity[hdr.pid] > 0)) {
-				if (!(hdr.adaptation_flags & 0x02) && (adapt.discontinuity)) {
-					push_discontinuity(hdr.pid);
+void stats::push(const uint8_t *p, uint16_t pid, bool tei, uint8_t ctrl)
+{
+	adaptation_field_t adapt;
+	unsigned int adaptation_flags = (ctrl & 0x30) >> 4;
+	unsigned int continuity_ctr   = (ctrl & 0x0f);
+
+	if (adaptation_flags & 0x02)
+		parse_adaptation(p, adapt);
+	else
+		adapt.discontinuity = 0;
+
+	if (adaptation_flags & 0x01) {// payload present
+		if (continuity.count(pid)) {
+			uint8_t next = (continuity[pid] + 1) & 0x0f;
+			if ((next != (continuity_ctr & 0x0f)) && (continuity_ctr + continuity[pid] > 0)) {
+				if (!(adaptation_flags & 0x02) && (adapt.discontinuity)) {
+					push_discontinuity(pid);
 #if DBG
-					dprintf("CONTINUITY ERROR pid: %04x cur: 0x%x prev 0x%x", hdr.pid, hdr.continuity_ctr, continuity[hdr.pid]);
+					dprintf("CONTINUITY ERROR pid: %04x cur: 0x%x prev 0x%x", pid, continuity_ctr, continuity[pid]);
 #endif
 				}
 			}
 		}
-		continuity[hdr.pid] = hdr.continuity_ctr;
+		continuity[pid] = continuity_ctr;
 	}
 
-	if (hdr.adaptation_flags & 0x02) {
+	if (adaptation_flags & 0x02) {
 		if (adapt.pcr) {
 			uint64_t pcr_base;
 			unsigned int pcr_ext;
 
 			parse_pcr(adapt.PCR, &pcr_base, &pcr_ext);
-			dprintf("PID: 0x%04x, PCR base: %" PRIu64 ", ext: %d", hdr.pid, pcr_base, pcr_ext);
+			dprintf("PID: 0x%04x, PCR base: %" PRIu64 ", ext: %d", pid, pcr_base, pcr_ext);
 
 #if DBG
-			stats_map::const_iterator iter = last_pcr_base.find(hdr.pid);
+			stats_map::const_iterator iter = last_pcr_base.find(pid);
 			if ((iter != last_pcr_base.end()) && (pcr_base < iter->second))
 				fprintf(stderr, "%s: PID: 0x%04x, %" PRIu64 " < %" PRIu64 " !!!\n",
-					__func__, hdr.pid, pcr_base, iter->second);
+					__func__, pid, pcr_base, iter->second);
 #endif
-			last_pcr_base[hdr.pid] = pcr_base;
+			last_pcr_base[pid] = pcr_base;
 		}
 		if (adapt.opcr) {
 			uint64_t pcr_base;
 			unsigned int pcr_ext;
 
 			parse_pcr(adapt.OPCR, &pcr_base, &pcr_ext);
-			dprintf("PID: 0x%04x, PCR base: %" PRIu64 ", ext: %d", hdr.pid, pcr_base, pcr_ext);
+			dprintf("PID: 0x%04x, PCR base: %" PRIu64 ", ext: %d", pid, pcr_base, pcr_ext);
 		}
 		if (adapt.splicing_point) {
-			dprintf("PID: 0x%04x, splicing countdown: %d", hdr.pid, adapt.splicing_countdown);
+			dprintf("PID: 0x%04x, splicing countdown: %d", pid, adapt.splicing_countdown);
 		}
 	}
 
-	push_stats(pkt_stats);
+	if (tei) {
+		tei_count++;
+		push_pid((uint16_t) - 1);
+	} else
+		push_pid(pid);
 }
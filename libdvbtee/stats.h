@@ -67,6 +67,17 @@ typedef struct
 	signed int splicing_countdown:8;
 } adaptation_field_t;
 
+#define STATS_BATCH 64
+
+/* the headers of a run of packets, a field per array */
+typedef struct
+{
+	int count;
+	uint16_t pid[STATS_BATCH];	/* (uint16_t) - 1 on sync loss */
+	uint8_t tei[STATS_BATCH];
+	uint8_t ctrl[STATS_BATCH];	/* 4th header byte: scrambling, adaptation flags, continuity counter */
+} pkt_hdr_batch_t;
+
 typedef time_t (*streamtime_callback)(void*);
 
 typedef void (*statistics_callback)(void *priv, stats_map &bitrates, stats_map &discontinuities, uint64_t tei_count, bool per_sec);
@@ -85,10 +96,14 @@ public:
 
 	void push_pid(const uint16_t pid) { push_pid(188, pid); }
 
-	void push(int c, const uint8_t *p, pkt_stats_t *pkt_stats = NULL) { for(int i = 0; i < c; i++) push(p+i*188, pkt_stats); }
+	void push(int c, const uint8_t *p, pkt_stats_t *pkt_stats = NULL);
 	void push(const uint8_t *p, pkt_stats_t *pkt_stats = NULL);
+	/* packet i of a batch from parse(c, p, batch) */
+	void push(const uint8_t *p, const pkt_hdr_batch_t *batch, int i);
 
 	pkt_stats_t *parse(const uint8_t *p, pkt_stats_t *pkt_stats);
+	/* decodes up to STATS_BATCH packets, returns how many */
+	int parse(int c, const uint8_t *p, pkt_hdr_batch_t *batch);
 private:
 	stats_map statistics;
 	stats_map discontinuities;
@@ -106,7 +121,8 @@ private:
 	statistics_callback statistics_cb;
 	void *statistics_priv;
 
-	pkt_stats_t *parse(const uint8_t *p, pkt_stats_t *pkt_stats, pkt_hdr_t &hdr, adaptation_field_t &adapt);
+	void parse_adaptation(const uint8_t *p, adaptation_field_t &adapt);
+	void push(const uint8_t *p, uint16_t pid, bool tei, uint8_t ctrl);
 
 	void __push_pid(int c, const uint16_t pid) { statistics[pid] += c; statistics[0x2000] += c; }
 	void push_pid(int c, const uint16_t pid);
@@ -115,7 +131,6 @@ private:
 
 	void show(bool per_sec = true);
 
-	void push_stats(pkt_stats_t *pkt_stats);
 	void push_discontinuity(const uint16_t pid) { discontinuities[pid]++; discontinuities[0x2000]++; }
 	void clear_stats();
 };
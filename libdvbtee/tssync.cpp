@@ -0,0 +1,337 @@
+/*****************************************************************************
+ * Copyright (C) 2011-2015 Michael Ira Krufky
+ *
+ * Author: Michael Ira Krufky <mkrufky@linuxtv.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "tssync.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define TSSYNC_SSE2
+#include <emmintrin.h>
+#if (__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9))
+#define TSSYNC_AVX2
+#include <immintrin.h>
+#endif
+#endif
+
+static inline bool is_sync(const uint8_t *p, int size, int offset, int stride)
+{
+	for (int i = 0; (i < TS_SYNC_DEPTH) && (offset < size); i++, offset += stride)
+		if (p[offset] != 0x47)
+			return false;
+	return true;
+}
+
+static int sync_offset_scalar(const uint8_t *p, int offset, int size, int stride)
+{
+	while (offset < size) {
+		const uint8_t *q = (const uint8_t *)memchr(p + offset, 0x47, size - offset);
+		if (!q)
+			break;
+		offset = q - p;
+		if (is_sync(p, size, offset, stride))
+			return offset;
+		offset++;
+	}
+	return size;
+}
+
+/* the vector loops only cover offsets whose every sync byte lies within
+ * the buffer, the scalar loop finishes the rest */
+#define SYNC_SPAN(stride) ((TS_SYNC_DEPTH - 1) * (stride))
+
+#ifdef TSSYNC_SSE2
+static int sync_offset_sse2(const uint8_t *p, int size, int stride)
+{
+	const __m128i sync = _mm_set1_epi8(0x47);
+	int offset = 0;
+
+	for (; offset + SYNC_SPAN(stride) + 16 <= size; offset += 16) {
+		__m128i m = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + offset)), sync);
+		for (int i = 1; i < TS_SYNC_DEPTH; i++)
+			m = _mm_and_si128(m, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + offset + i * stride)), sync));
+		unsigned int mask = _mm_movemask_epi8(m);
+		if (mask)
+			return offset + __builtin_ctz(mask);
+	}
+	return sync_offset_scalar(p, offset, size, stride);
+}
+#endif
+
+#ifdef TSSYNC_AVX2
+__attribute__((target("avx2")))
+static int sync_offset_avx2(const uint8_t *p, int size, int stride)
+{
+	const __m256i sync = _mm256_set1_epi8(0x47);
+	int offset = 0;
+
+	for (; offset + SYNC_SPAN(stride) + 32 <= size; offset += 32) {
+		__m256i m = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + offset)), sync);
+		for (int i = 1; i < TS_SYNC_DEPTH; i++)
+			m = _mm256_and_si256(m, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + offset + i * stride)), sync));
+		unsigned int mask = _mm256_movemask_epi8(m);
+		if (mask)
+			return offset + __builtin_ctz(mask);
+	}
+	return sync_offset_scalar(p, offset, size, stride);
+}
+#endif
+
+typedef int (*sync_offset_fn)(const uint8_t *, int, int);
+
+#ifndef TSSYNC_SSE2
+static int sync_offset_generic(const uint8_t *p, int size, int stride)
+{
+	return sync_offset_scalar(p, 0, size, stride);
+}
+#endif
+
+static sync_offset_fn pick_sync_offset()
+{
+#ifdef TSSYNC_AVX2
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return sync_offset_avx2;
+#endif
+#ifdef TSSYNC_SSE2
+	return sync_offset_sse2;
+#else
+	return sync_offset_generic;
+#endif
+}
+
+int ts_sync_offset(const uint8_t *p, int size, int stride)
+{
+	static sync_offset_fn fn = NULL;
+
+	/* racing callers all pick the same function */
+	sync_offset_fn f = __atomic_load_n(&fn, __ATOMIC_RELAXED);
+	if (!f) {
+		f = pick_sync_offset();
+		__atomic_store_n(&fn, f, __ATOMIC_RELAXED);
+	}
+	return (size > 0) ? f(p, size, stride) : 0;
+}
+
+int ts_detect_packet_size(const uint8_t *p, int size)
+{
+	static const int strides[] = { 188, 204, 192 };
+
+	for (unsigned int i = 0; i < sizeof(strides) / sizeof(strides[0]); i++) {
+		int stride = strides[i];
+		int span = TS_DETECT_DEPTH * stride;
+
+		/* the sync byte follows the timestamp in 192 byte packets,
+		 * but a run of them is just as periodic from anywhere */
+		for (int offset = 0; (offset < stride) && (offset + span <= size); offset++) {
+			int n;
+			for (n = 0; n < TS_DETECT_DEPTH; n++)
+				if (p[offset + n * stride] != 0x47)
+					break;
+			if (n == TS_DETECT_DEPTH)
+				return stride;
+		}
+	}
+	/* out of luck, leave it to the resync of the parser */
+	return (size >= TS_DETECT_SIZE) ? 188 : 0;
+}
+
+/*****************************************************************************/
+
+ts_normalizer::ts_normalizer()
+  : packet_size(0)
+  , forced_size(0)
+  , carry_len(0)
+  , hold(NULL)
+  , hold_len(0)
+  , out_buf(NULL)
+  , out_size(0)
+  , ats(0)
+  , sync_loss_count(0)
+{
+}
+
+ts_normalizer::~ts_normalizer()
+{
+	free(hold);
+	free(out_buf);
+}
+
+ts_normalizer::ts_normalizer(const ts_normalizer&)
+{
+	packet_size = 0;
+	forced_size = 0;
+	carry_len = 0;
+	hold = NULL;
+	hold_len = 0;
+	out_buf = NULL;
+	out_size = 0;
+	ats = 0;
+	sync_loss_count = 0;
+}
+
+ts_normalizer& ts_normalizer::operator= (const ts_normalizer& cSource)
+{
+	if (this == &cSource)
+		return *this;
+
+	reset();
+	forced_size = 0;
+	packet_size = 0;
+
+	return *this;
+}
+
+void ts_normalizer::set_packet_size(int size)
+{
+	forced_size = ((size == 188) || (size == 192) || (size == 204)) ? size : 0;
+	reset();
+}
+
+void ts_normalizer::reset()
+{
+	packet_size = forced_size;
+	carry_len = 0;
+	hold_len = 0;
+	ats = 0;
+	sync_loss_count = 0;
+}
+
+const uint8_t *ts_normalizer::grow(int size)
+{
+	if (size > out_size) {
+		uint8_t *p = (uint8_t *)realloc(out_buf, size);
+		if (!p)
+			return NULL;
+		out_buf = p;
+		out_size = size;
+	}
+	return out_buf;
+}
+
+int ts_normalizer::push(const uint8_t *p, int size, const uint8_t **out)
+{
+	*out = p;
+
+	if (size <= 0)
+		return 0;
+
+	if (!packet_size) {
+		/* gather enough of the start of the stream to tell */
+		if (!hold)
+			hold = (uint8_t *)malloc(TS_DETECT_SIZE);
+		if (!hold) {
+			packet_size = 188;
+			return size;
+		}
+		int len = TS_DETECT_SIZE - hold_len;
+		if (len > size)
+			len = size;
+		memcpy(hold + hold_len, p, len);
+		hold_len += len;
+
+		packet_size = ts_detect_packet_size(hold, hold_len);
+		if (!packet_size)
+			return 0;
+
+		/* the held bytes go first, then the rest of this buffer */
+		int held = hold_len;
+		hold_len = 0;
+		if (packet_size == 188) {
+			if (!grow(size - len + held))
+				return 0;
+			memcpy(out_buf, hold, held);
+			memcpy(out_buf + held, p + len, size - len);
+			*out = out_buf;
+			return size - len + held;
+		}
+		int n = convert(hold, held, 0);
+		n += convert(p + len, size - len, n);
+		*out = out_buf;
+		return n;
+	}
+
+	if (packet_size == 188)
+		return size;
+
+	int n = convert(p, size, 0);
+	*out = out_buf;
+	return n;
+}
+
+/* strip the timestamp or parity of every packet, into out_buf from
+ * offset onwards.  returns the number of bytes added */
+int ts_normalizer::convert(const uint8_t *p, int size, int offset)
+{
+	int stride = packet_size;
+	int pos = (stride == 192) ? 4 : 0;
+
+	if (!grow(offset + ((carry_len + size) / stride + 1) * 188))
+		return 0;
+
+	uint8_t *q = out_buf + offset;
+
+	if (carry_len) {
+		int len = stride - carry_len;
+		if (len > size)
+			len = size;
+		memcpy(carry_pkt + carry_len, p, len);
+		carry_len += len;
+		p += len;
+		size -= len;
+
+		if (carry_len < stride)
+			return 0;
+
+		carry_len = 0;
+		if (carry_pkt[pos] == 0x47) {
+			if (pos)
+				ats = ((carry_pkt[0] << 24) | (carry_pkt[1] << 16) | (carry_pkt[2] << 8) | carry_pkt[3]) & 0x3fffffff;
+			memcpy(q, carry_pkt + pos, 188);
+			q += 188;
+		} else
+			sync_loss_count++;
+	}
+
+	while (size >= stride) {
+		if (p[pos] != 0x47) {
+			int skip = ts_sync_offset(p + pos, size - pos, stride);
+			sync_loss_count++;
+			p += skip;
+			size -= skip;
+			continue;
+		}
+		if (pos)
+			ats = ((p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]) & 0x3fffffff;
+		memcpy(q, p + pos, 188);
+		q += 188;
+		p += stride;
+		size -= stride;
+	}
+
+	if (size > 0) {
+		memcpy(carry_pkt, p, size);
+		carry_len = size;
+	}
+
+	return q - (out_buf + offset);
+}
@@ -0,0 +1,91 @@
+/*****************************************************************************
+ * Copyright (C) 2011-2015 Michael Ira Krufky
+ *
+ * Author: Michael Ira Krufky <mkrufky@linuxtv.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+#ifndef __TSSYNC_H__
+#define __TSSYNC_H__
+
+#include <stdint.h>
+
+/* number of sync bytes, a packet apart, that make a packet boundary */
+#define TS_SYNC_DEPTH 3
+
+/* offset of the first packet boundary within size bytes, or size if
+ * there is none.  a boundary has 0x47 at the start of each of the next
+ * TS_SYNC_DEPTH packets, as far as they lie within the buffer */
+int ts_sync_offset(const uint8_t *p, int size, int stride = 188);
+
+/* sync bytes needed in a row to settle on a packet size */
+#define TS_DETECT_DEPTH 5
+#define TS_DETECT_SIZE  ((TS_DETECT_DEPTH + 1) * 204)
+
+/* 188, 192 (m2ts, with a timestamp up front) or 204 (with parity), from
+ * the start of a stream.  0 while there are too few bytes to tell */
+int ts_detect_packet_size(const uint8_t *p, int size);
+
+/* turns a stream of 192 or 204 byte packets into 188 byte packets,
+ * with the packet size detected unless it is set.  188 byte packets
+ * are passed through as they are */
+class ts_normalizer
+{
+public:
+	ts_normalizer();
+	~ts_normalizer();
+
+	ts_normalizer(const ts_normalizer&);
+	ts_normalizer& operator= (const ts_normalizer&);
+
+	/* 0 to detect it, which is the default */
+	void set_packet_size(int);
+	/* 0 until detected */
+	int  get_packet_size() { return packet_size; }
+
+	/* for a new stream */
+	void reset();
+
+	/* returns the number of bytes of 188 byte packets at *out, which is
+	 * either p or a buffer of our own, valid until the next push() */
+	int  push(const uint8_t *p, int size, const uint8_t **out);
+
+	/* the 30 bit, 27 MHz arrival timestamp of the last m2ts packet */
+	uint32_t get_arrival_time() { return ats; }
+	unsigned int get_sync_loss_count() { return sync_loss_count; }
+private:
+	int packet_size;
+	int forced_size;
+
+	uint8_t carry_pkt[204];
+	int carry_len;
+
+	/* the start of the stream, while detecting */
+	uint8_t *hold;
+	int hold_len;
+
+	uint8_t *out_buf;
+	int out_size;
+
+	uint32_t ats;
+	unsigned int sync_loss_count;
+
+	const uint8_t *grow(int);
+	int convert(const uint8_t *p, int size, int offset);
+};
+
+#endif /* __TSSYNC_H__ */
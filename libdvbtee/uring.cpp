@@ -0,0 +1,649 @@
+/*****************************************************************************
+ * Copyright (C) 2011-2015 Michael Ira Krufky
+ *
+ * Author: Michael Ira Krufky <mkrufky@linuxtv.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+#include "dvbtee_config.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#include "uring.h"
+#include "feed.h"
+#include "log.h"
+#define CLASS_MODULE "uring"
+
+#define dprintf(fmt, arg...) __dprintf(DBG_FEED, fmt, ##arg)
+
+#ifdef USE_IO_URING
+#include <linux/io_uring.h>
+#endif
+
+/* user_data of anything that is not a read: the tick and cancellations */
+#define URING_TICK   0
+#define URING_CANCEL (1ULL << 32)
+
+uring_engine::uring_engine()
+  : h_thread((pthread_t)NULL)
+  , f_kill_thread(false)
+  , f_running(false)
+  , cpu(-1)
+  , ring_fd(-1)
+  , sq_ring(NULL)
+  , cq_ring(NULL)
+  , sq_ring_size(0)
+  , cq_ring_size(0)
+  , sqes(NULL)
+  , sqes_size(0)
+  , sq_head(NULL)
+  , sq_tail(NULL)
+  , sq_mask(NULL)
+  , sq_array(NULL)
+  , cq_head(NULL)
+  , cq_tail(NULL)
+  , cq_mask(NULL)
+  , cqes(NULL)
+  , sq_entries(0)
+  , to_submit(0)
+  , slot_bufs(NULL)
+  , fixed_bufs(false)
+  , dgram_bufs(NULL)
+  , dgram_ring(NULL)
+  , dgram_tail(0)
+  , multishot(false)
+  , tick_armed(false)
+{
+	dprintf("()");
+	pthread_mutex_init(&mutex, 0);
+	memset(&slots, 0, sizeof(slots));
+	memset(&tick, 0, sizeof(tick));
+}
+
+uring_engine::~uring_engine()
+{
+	dprintf("()");
+
+	stop();
+	teardown();
+
+	pthread_mutex_destroy(&mutex);
+}
+
+#ifdef USE_IO_URING
+
+static int sys_io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned int opcode, void *arg, unsigned int nr_args)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+bool uring_engine::init(unsigned int entries)
+{
+	struct io_uring_params p;
+
+	dprintf("(%d)", entries);
+
+	if (ring_fd >= 0)
+		return true;
+
+	memset(&p, 0, sizeof(p));
+
+	ring_fd = sys_io_uring_setup(entries, &p);
+	if (ring_fd < 0) {
+		perror("io_uring_setup failed");
+		return false;
+	}
+
+	sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	cq_ring_size = p.cq_off.cqes  + p.cq_entries * sizeof(struct io_uring_cqe);
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (cq_ring_size > sq_ring_size)
+			sq_ring_size = cq_ring_size;
+		cq_ring_size = sq_ring_size;
+	}
+
+	sq_ring = mmap(NULL, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+	if (sq_ring == MAP_FAILED) {
+		sq_ring = NULL;
+		goto fail;
+	}
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		cq_ring = sq_ring;
+	else {
+		cq_ring = mmap(NULL, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+		if (cq_ring == MAP_FAILED) {
+			cq_ring = NULL;
+			goto fail;
+		}
+	}
+	sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	sqes = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED) {
+		sqes = NULL;
+		goto fail;
+	}
+
+	sq_head  = (unsigned int *)((char *)sq_ring + p.sq_off.head);
+	sq_tail  = (unsigned int *)((char *)sq_ring + p.sq_off.tail);
+	sq_mask  = (unsigned int *)((char *)sq_ring + p.sq_off.ring_mask);
+	sq_array = (unsigned int *)((char *)sq_ring + p.sq_off.array);
+	cq_head  = (unsigned int *)((char *)cq_ring + p.cq_off.head);
+	cq_tail  = (unsigned int *)((char *)cq_ring + p.cq_off.tail);
+	cq_mask  = (unsigned int *)((char *)cq_ring + p.cq_off.ring_mask);
+	cqes     = (char *)cq_ring + p.cq_off.cqes;
+	sq_entries = p.sq_entries;
+
+	slot_bufs = (uint8_t *)mmap(NULL, URING_MAX_FEEDS * URING_SLOT_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (slot_bufs == MAP_FAILED) {
+		slot_bufs = NULL;
+		goto fail;
+	} else {
+		struct iovec iov[URING_MAX_FEEDS];
+
+		for (int i = 0; i < URING_MAX_FEEDS; i++) {
+			iov[i].iov_base = slot_bufs + i * URING_SLOT_SIZE;
+			iov[i].iov_len  = URING_SLOT_SIZE;
+		}
+		/* pinned once up front rather than on every read.  plain reads
+		 * into the same memory do if this exceeds RLIMIT_MEMLOCK */
+		fixed_bufs = (0 == sys_io_uring_register(ring_fd, IORING_REGISTER_BUFFERS, iov, URING_MAX_FEEDS));
+		if (!fixed_bufs)
+			perror("io_uring buffer registration failed");
+	}
+#ifdef IORING_RECV_MULTISHOT
+	dgram_bufs = (uint8_t *)mmap(NULL, URING_DGRAM_BUFS * URING_DGRAM_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	dgram_ring = mmap(NULL, URING_DGRAM_BUFS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if ((dgram_bufs != MAP_FAILED) && (dgram_ring != MAP_FAILED)) {
+		struct io_uring_buf_reg reg;
+
+		memset(&reg, 0, sizeof(reg));
+		reg.ring_addr    = (unsigned long)dgram_ring;
+		reg.ring_entries = URING_DGRAM_BUFS;
+		reg.bgid         = 0;
+
+		multishot = (0 == sys_io_uring_register(ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1));
+		if (multishot) {
+			for (unsigned int i = 0; i < URING_DGRAM_BUFS; i++)
+				recycle_dgram(i);
+		} else
+			dprintf("provided buffer rings unsupported, udp input stays on its own thread");
+	}
+	if (dgram_bufs == MAP_FAILED)
+		dgram_bufs = NULL;
+	if (dgram_ring == MAP_FAILED)
+		dgram_ring = NULL;
+#endif
+	dprintf("%d entries%s%s", sq_entries,
+		(fixed_bufs) ? ", registered buffers" : "",
+		(multishot) ? ", multishot receive" : "");
+	return true;
+fail:
+	perror("io_uring mapping failed");
+	teardown();
+	return false;
+}
+
+void uring_engine::teardown()
+{
+	if ((sq_ring) && (cq_ring != sq_ring))
+		munmap(cq_ring, cq_ring_size);
+	if (sq_ring)
+		munmap(sq_ring, sq_ring_size);
+	if (sqes)
+		munmap(sqes, sqes_size);
+	if (slot_bufs)
+		munmap(slot_bufs, URING_MAX_FEEDS * URING_SLOT_SIZE);
+#ifdef IORING_RECV_MULTISHOT
+	if (dgram_bufs)
+		munmap(dgram_bufs, URING_DGRAM_BUFS * URING_DGRAM_SIZE);
+	if (dgram_ring)
+		munmap(dgram_ring, URING_DGRAM_BUFS * sizeof(struct io_uring_buf));
+#endif
+	if (ring_fd >= 0)
+		close(ring_fd);
+
+	ring_fd = -1;
+	sq_ring = cq_ring = sqes = NULL;
+	slot_bufs = dgram_bufs = NULL;
+	dgram_ring = NULL;
+	fixed_bufs = multishot = false;
+}
+
+/* mutex held */
+void *uring_engine::get_sqe()
+{
+	unsigned int tail = *sq_tail;
+
+	/* the kernel consumes everything we have submitted right away,
+	 * so a full queue only means it is time to submit */
+	if (tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries)
+		submit();
+
+	unsigned int idx = tail & *sq_mask;
+	struct io_uring_sqe *sqe = &((struct io_uring_sqe *)sqes)[idx];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sq_array[idx] = idx;
+
+	__atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+	to_submit++;
+
+	return sqe;
+}
+
+/* mutex held */
+void uring_engine::submit()
+{
+	while (to_submit) {
+		int ret = sys_io_uring_enter(ring_fd, to_submit, 0, 0);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("io_uring_enter failed");
+			break;
+		}
+		to_submit -= ret;
+		if (!ret)
+			break;
+	}
+}
+
+/* mutex held */
+void uring_engine::submit_read(int idx)
+{
+	struct uring_slot *slot = &slots[idx];
+	struct io_uring_sqe *sqe = (struct io_uring_sqe *)get_sqe();
+
+	sqe->fd = slot->fd;
+	sqe->user_data = idx + 1;
+
+	if (slot->type == URING_DGRAM) {
+#ifdef IORING_RECV_MULTISHOT
+		/* armed once, completes for every datagram until cancelled */
+		sqe->opcode    = IORING_OP_RECV;
+		sqe->ioprio    = IORING_RECV_MULTISHOT;
+		sqe->flags     = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = 0;
+#endif
+	} else {
+		sqe->opcode    = (fixed_bufs) ? IORING_OP_READ_FIXED : IORING_OP_READ;
+		sqe->addr      = (unsigned long)(slot_bufs + idx * URING_SLOT_SIZE);
+		sqe->len       = URING_SLOT_SIZE;
+		sqe->buf_index = idx;
+		/* -1 reads from the current position, for pipes and sockets */
+		sqe->off       = (uint64_t)slot->offset;
+	}
+	slot->busy = true;
+}
+
+/* mutex held */
+void uring_engine::submit_cancel(int idx)
+{
+	struct io_uring_sqe *sqe = (struct io_uring_sqe *)get_sqe();
+
+	sqe->opcode    = IORING_OP_ASYNC_CANCEL;
+	sqe->fd        = -1;
+	sqe->addr      = idx + 1;
+	sqe->user_data = URING_CANCEL | idx;
+}
+
+/* mutex held */
+void uring_engine::arm_tick()
+{
+	struct io_uring_sqe *sqe = (struct io_uring_sqe *)get_sqe();
+
+	tick.tv_sec  = 0;
+	tick.tv_nsec = 100*1000*1000;
+
+	sqe->opcode    = IORING_OP_TIMEOUT;
+	sqe->fd        = -1;
+	sqe->addr      = (unsigned long)&tick;
+	sqe->len       = 1;
+	sqe->user_data = URING_TICK;
+
+	tick_armed = true;
+}
+
+void uring_engine::recycle_dgram(unsigned int bid)
+{
+#ifdef IORING_RECV_MULTISHOT
+	struct io_uring_buf *bufs = (struct io_uring_buf *)dgram_ring;
+	struct io_uring_buf *buf = &bufs[dgram_tail & (URING_DGRAM_BUFS - 1)];
+
+	buf->addr = (unsigned long)(dgram_bufs + bid * URING_DGRAM_SIZE);
+	buf->len  = URING_DGRAM_SIZE;
+	buf->bid  = bid;
+
+	/* the ring tail overlays the reserved field of the first entry */
+	dgram_tail++;
+	__atomic_store_n(&((uint16_t *)dgram_ring)[7], dgram_tail, __ATOMIC_RELEASE);
+#else
+	(void)bid;
+#endif
+}
+
+int uring_engine::add(feed *f, int fd, enum uring_feed_type type)
+{
+	struct stat st;
+	int idx, ret = -1;
+
+	dprintf("(%d, %s)", fd,
+		(type == URING_DGRAM)  ? "udp" :
+		(type == URING_STREAM) ? "tcp" : "file");
+
+	if ((ring_fd < 0) || (fd < 0) || (f_kill_thread))
+		return -1;
+
+	if ((type == URING_DGRAM) && (!multishot))
+		return -1;
+
+	pthread_mutex_lock(&mutex);
+
+	for (idx = 0; idx < URING_MAX_FEEDS; idx++)
+		if (!slots[idx].f)
+			break;
+
+	if (idx == URING_MAX_FEEDS) {
+		dprintf("no free slots");
+		goto out;
+	}
+
+	slots[idx].f      = f;
+	slots[idx].fd     = fd;
+	slots[idx].type   = type;
+	slots[idx].cancel = false;
+	slots[idx].offset = -1;
+	if ((type == URING_FILE) && (0 == fstat(fd, &st)) && (S_ISREG(st.st_mode)))
+		slots[idx].offset = lseek(fd, 0, SEEK_CUR);
+
+	submit_read(idx);
+	submit();
+	ret = 0;
+out:
+	pthread_mutex_unlock(&mutex);
+
+	return ret;
+}
+
+void uring_engine::remove(feed *f)
+{
+	int idx;
+
+	pthread_mutex_lock(&mutex);
+
+	for (idx = 0; idx < URING_MAX_FEEDS; idx++)
+		if (slots[idx].f == f)
+			break;
+
+	if (idx == URING_MAX_FEEDS) {
+		pthread_mutex_unlock(&mutex);
+		return;
+	}
+	dprintf("(%d)", slots[idx].fd);
+
+	slots[idx].cancel = true;
+	if (slots[idx].busy) {
+		submit_cancel(idx);
+		submit();
+	}
+	pthread_mutex_unlock(&mutex);
+
+	/* the engine thread releases the slot once the read has completed */
+	while ((f_running) && (slots[idx].f == f))
+		usleep(20*1000);
+
+	/* nobody is left to do so */
+	if (slots[idx].f == f)
+		release(idx);
+}
+
+/* closes the feed, called once nothing is in flight for the slot */
+void uring_engine::release(int idx)
+{
+	feed *f = slots[idx].f;
+
+	dprintf("(%d)", slots[idx].fd);
+
+	pthread_mutex_lock(&mutex);
+	slots[idx].busy = false;
+	pthread_mutex_unlock(&mutex);
+
+	f->stop_without_wait();
+	f->close_file();
+
+	__atomic_store_n(&slots[idx].f, (feed *)NULL, __ATOMIC_RELEASE);
+}
+
+void uring_engine::complete(uint64_t user_data, int res, unsigned int flags)
+{
+	if (user_data == URING_TICK) {
+		tick_armed = false;
+		return;
+	}
+	if (user_data & URING_CANCEL)
+		return;
+
+	int idx = (int)user_data - 1;
+	struct uring_slot *slot = &slots[idx];
+	bool again = false;
+
+	if ((idx < 0) || (idx >= URING_MAX_FEEDS) || (!slot->f))
+		return;
+
+	if (slot->type == URING_DGRAM) {
+#ifdef IORING_RECV_MULTISHOT
+		if ((res > 0) && (flags & IORING_CQE_F_BUFFER)) {
+			unsigned int bid = flags >> IORING_CQE_BUFFER_SHIFT;
+
+			slot->f->push(res, dgram_bufs + bid * URING_DGRAM_SIZE);
+			recycle_dgram(bid);
+		}
+		/* still armed */
+		if (flags & IORING_CQE_F_MORE)
+			return;
+
+		again = ((res >= 0) || (res == -ENOBUFS) || (res == -EINTR) || (res == -EAGAIN));
+#endif
+	} else if (res > 0) {
+		slot->f->push(res, slot_bufs + idx * URING_SLOT_SIZE);
+		if (slot->offset >= 0)
+			slot->offset += res;
+		again = true;
+	} else
+		again = ((res == -EINTR) || (res == -EAGAIN));
+
+	if ((res < 0) && (!again) && (res != -ECANCELED))
+		fprintf(stderr, "%s: fd %d: %s\n", __func__, slot->fd, strerror(-res));
+
+	pthread_mutex_lock(&mutex);
+	slot->busy = false;
+	again = ((again) && (!slot->cancel) && (!f_kill_thread));
+	if (again)
+		submit_read(idx);
+	pthread_mutex_unlock(&mutex);
+
+	/* end of file, an error, or cancelled */
+	if (!again)
+		release(idx);
+}
+
+//static
+void* uring_engine::engine_thread(void *p_this)
+{
+	return static_cast<uring_engine*>(p_this)->engine_thread();
+}
+
+void *uring_engine::engine_thread()
+{
+	dprintf("()");
+
+	if (cpu >= 0) {
+		cpu_set_t cpuset;
+
+		CPU_ZERO(&cpuset);
+		CPU_SET(cpu, &cpuset);
+		if (0 != pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset))
+			perror("pthread_setaffinity_np() failed");
+	}
+	f_running = true;
+
+	bool cancelled = false;
+
+	for (;;) {
+		bool busy = false;
+
+		pthread_mutex_lock(&mutex);
+		if ((f_kill_thread) && (!cancelled)) {
+			/* cancel whatever is still in flight, and keep going
+			 * until the completions have handed the feeds back */
+			for (int idx = 0; idx < URING_MAX_FEEDS; idx++)
+				if ((slots[idx].f) && (slots[idx].busy)) {
+					slots[idx].cancel = true;
+					submit_cancel(idx);
+				}
+			cancelled = true;
+		}
+		for (int idx = 0; idx < URING_MAX_FEEDS; idx++)
+			busy |= ((slots[idx].f) && (slots[idx].busy));
+
+		if ((f_kill_thread) && (!busy)) {
+			pthread_mutex_unlock(&mutex);
+			break;
+		}
+		/* wake up regularly, so that stop() is noticed */
+		if (!tick_armed)
+			arm_tick();
+		submit();
+		pthread_mutex_unlock(&mutex);
+
+		if ((sys_io_uring_enter(ring_fd, 0, 1, IORING_ENTER_GETEVENTS) < 0) && (errno != EINTR)) {
+			perror("io_uring_enter failed");
+			break;
+		}
+
+		unsigned int head = *cq_head;
+		unsigned int tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+
+		while (head != tail) {
+			struct io_uring_cqe *cqe = &((struct io_uring_cqe *)cqes)[head & *cq_mask];
+
+			complete(cqe->user_data, cqe->res, cqe->flags);
+
+			__atomic_store_n(cq_head, ++head, __ATOMIC_RELEASE);
+		}
+	}
+
+	for (int idx = 0; idx < URING_MAX_FEEDS; idx++)
+		if (slots[idx].f)
+			release(idx);
+
+	f_running = false;
+	pthread_exit(NULL);
+}
+
+#else /* USE_IO_URING */
+
+bool uring_engine::init(unsigned int entries)
+{
+	(void)entries;
+	dprintf("io_uring support not built in");
+	return false;
+}
+
+void uring_engine::teardown()
+{
+}
+
+int uring_engine::add(feed *f, int fd, enum uring_feed_type type)
+{
+	(void)f;
+	(void)fd;
+	(void)type;
+	return -1;
+}
+
+void uring_engine::remove(feed *f)
+{
+	(void)f;
+}
+
+void *uring_engine::engine_thread()
+{
+	pthread_exit(NULL);
+}
+
+//static
+void* uring_engine::engine_thread(void *p_this)
+{
+	return static_cast<uring_engine*>(p_this)->engine_thread();
+}
+
+#endif /* USE_IO_URING */
+
+int uring_engine::start(int cpu_requested)
+{
+	dprintf("(%d)", cpu_requested);
+
+	if (ring_fd < 0)
+		return -1;
+
+	if (f_running)
+		return 0;
+
+	cpu = cpu_requested;
+	f_kill_thread = false;
+
+	int ret = pthread_create(&h_thread, NULL, engine_thread, this);
+	if (0 != ret)
+		perror("pthread_create() failed");
+	else
+		while ((!f_running) && (!f_kill_thread))
+			usleep(1000);
+
+	return ret;
+}
+
+void uring_engine::stop()
+{
+	dprintf("()");
+
+	if (!f_running)
+		return;
+
+	f_kill_thread = true;
+
+	pthread_join(h_thread, NULL);
+}
@@ -0,0 +1,133 @@
+/*****************************************************************************
+ * Copyright (C) 2011-2015 Michael Ira Krufky
+ *
+ * Author: Michael Ira Krufky <mkrufky@linuxtv.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+#ifndef __URING_H__
+#define __URING_H__
+
+#include <pthread.h>
+#include <stdint.h>
+
+class feed;
+
+#define URING_MAX_FEEDS    64
+/* per feed, for file and tcp input */
+#define URING_SLOT_SIZE    (188*512)
+/* shared by all udp input of an engine, one datagram each */
+#define URING_DGRAM_BUFS   1024
+#define URING_DGRAM_SIZE   (188*7)
+
+enum uring_feed_type {
+	URING_FILE,
+	URING_STREAM,
+	URING_DGRAM,
+};
+
+/* a single thread serving the input of many feeds through one io_uring
+ * instance.  create one per core and spread the feeds across them.
+ * data is parsed on the engine thread, set_buffer_size() does not apply */
+class uring_engine
+{
+public:
+	uring_engine();
+	~uring_engine();
+
+	/* false if the kernel lacks io_uring, feeds keep their own threads */
+	bool init(unsigned int entries = 256);
+
+	/* the engine thread is pinned to cpu unless it is negative */
+	int start(int cpu = -1);
+	void stop();
+
+	/* returns < 0 if this input type is unsupported or the engine is full */
+	int add(feed*, int fd, enum uring_feed_type);
+	/* blocks until the engine has let go of the feed and closed its fd */
+	void remove(feed*);
+
+	bool is_running() { return ((!f_kill_thread) && (f_running)); }
+private:
+	/* not copyable */
+	uring_engine(const uring_engine&);
+	uring_engine& operator= (const uring_engine&);
+
+	pthread_t h_thread;
+	bool f_kill_thread;
+	bool f_running;
+	int cpu;
+
+	void *engine_thread();
+	static void *engine_thread(void*);
+
+	/* serializes the submission queue and the slots */
+	pthread_mutex_t mutex;
+
+	int ring_fd;
+
+	void *sq_ring;
+	void *cq_ring;
+	size_t sq_ring_size;
+	size_t cq_ring_size;
+	void *sqes;
+	size_t sqes_size;
+
+	unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	void *cqes;
+	unsigned int sq_entries;
+	unsigned int to_submit;
+
+	/* registered with the kernel, URING_SLOT_SIZE per slot */
+	uint8_t *slot_bufs;
+	bool fixed_bufs;
+
+	/* provided buffer ring for multishot udp receive */
+	uint8_t *dgram_bufs;
+	void *dgram_ring;
+	uint16_t dgram_tail;
+	bool multishot;
+
+	struct uring_slot {
+		feed *f;
+		int fd;
+		enum uring_feed_type type;
+		int64_t offset;
+		bool busy;
+		bool cancel;
+	} slots[URING_MAX_FEEDS];
+
+	struct {
+		int64_t tv_sec;
+		long long tv_nsec;
+	} tick;
+	bool tick_armed;
+
+	void *get_sqe();
+	void submit();
+	void submit_read(int idx);
+	void submit_cancel(int idx);
+	void arm_tick();
+	void recycle_dgram(unsigned int bid);
+	void release(int idx);
+	void complete(uint64_t user_data, int res, unsigned int flags);
+
+	void teardown();
+};
+
+#endif /* __URING_H__ */